@@ -47,13 +47,29 @@
 #include "input/alsa.h"
 #include "input/common.h"
 #include "input/fifo.h"
+#include "input/file.h"
+#include "input/record.h"
+#include "input/replay.h"
+#include "input/jack.h"
 #include "input/portaudio.h"
 #include "input/pulse.h"
 #include "input/shmem.h"
 #include "input/sndio.h"
+#include "input/synthetic.h"
 
 #include "config.h"
 
+// fftw: single precision with configure --enable-float, see dsp_real
+#ifdef FLOAT_DSP
+#define FFTW(name) fftwf_##name
+#define dsp_sqrt sqrtf
+#define FFTW_WISDOM_FILE "fftwf_wisdom"
+#else
+#define FFTW(name) fftw_##name
+#define dsp_sqrt sqrt
+#define FFTW_WISDOM_FILE "fftw_wisdom"
+#endif
+
 #ifdef ARTNET
 #include "output/artnet.h"
 #endif
@@ -66,7 +82,6 @@
 #define GCC_UNUSED /* nothing */
 #endif
 
-pthread_mutex_t lock;
 // used by sig handler
 // needs to know output mode in order to clean up terminal
 int output_mode;
@@ -81,12 +96,29 @@ int should_quit = 0;
 // will allow us to not free them on exit without ASan complaining
 struct config_params p;
 
-fftw_complex *out_bass_l, *out_bass_r;
-fftw_plan p_bass_l, p_bass_r;
-fftw_complex *out_mid_l, *out_mid_r;
-fftw_plan p_mid_l, p_mid_r;
-fftw_complex *out_treble_l, *out_treble_r;
-fftw_plan p_treble_l, p_treble_r;
+#define MAX_CHANNELS 2
+
+// sample rate the configured fft_sizes are meant for
+#define FFT_REFERENCE_RATE 44100
+
+// FFT output of every band, one block of fft_bins (N / 2 + 1) per channel with the left channel
+// first
+FFTW(complex) *fft_out[MAX_FFT_BANDS];
+int fft_bins[MAX_FFT_BANDS];
+// one plan per band for all channels, or one per channel when the channels run on their own
+// threads
+FFTW(plan) fft_plan[MAX_FFT_BANDS][MAX_CHANNELS];
+int fft_plan_count;
+
+// magnitudes of the FFT output, only computed for the bins some bar uses
+dsp_real *magnitude[MAX_CHANNELS][MAX_FFT_BANDS];
+
+// process: every bar averages one contiguous range of bins from one band
+struct bar_bins {
+    int band;
+    int first, count;
+    dsp_real weight; // 1 / count
+};
 
 #ifdef ARTNET
 ArtnetT* artnet = NULL;
@@ -151,41 +183,704 @@ static bool directory_exists(const char *path) {
 
 #endif
 
-int *monstercat_filter(int *bars, int number_of_bars, int waves, double monstercat) {
+// fftw: plans are cached as wisdom between runs, so only the first start pays for measuring
+static bool get_wisdom_path(char *path, size_t size) {
+    char *cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome != NULL) {
+        mkdir(cacheHome, 0777);
+        snprintf(path, size, "%s/%s/", cacheHome, PACKAGE);
+    } else {
+        cacheHome = getenv("HOME");
+        if (cacheHome == NULL)
+            return false;
+        snprintf(path, size, "%s/%s/", cacheHome, ".cache");
+        mkdir(path, 0777);
+        snprintf(path, size, "%s/%s/%s/", cacheHome, ".cache", PACKAGE);
+    }
+    mkdir(path, 0777);
+    strncat(path, FFTW_WISDOM_FILE, size - strlen(path) - 1);
+    return true;
+}
 
-    int z;
+static unsigned int get_planner_flags(enum fft_planner planner) {
+    switch (planner) {
+    case PLANNER_ESTIMATE:
+        return FFTW_ESTIMATE;
+    case PLANNER_PATIENT:
+        return FFTW_PATIENT;
+    default:
+        return FFTW_MEASURE;
+    }
+}
 
-    // process [smoothing]: monstercat-style "average"
+// fftw: plan count channels of a band in one go, reading the interleaved input with a stride of
+// channels and writing one block of bins per channel
+static FFTW(plan) plan_band(int size, int count, int channels, dsp_real *in, FFTW(complex) *out,
+                            unsigned int planner_flags) {
+    return FFTW(plan_many_dft_r2c)(1, &size, count, in, NULL, channels, 1, out, NULL, 1,
+                                   size / 2 + 1, planner_flags);
+}
 
-    int m_y, de;
-    if (waves > 0) {
-        for (z = 0; z < number_of_bars; z++) { // waves
-            bars[z] = bars[z] / 1.25;
-            // if (bars[z] < 1) bars[z] = 1;
-            for (m_y = z - 1; m_y >= 0; m_y--) {
-                de = z - m_y;
-                bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+// dsp: fft_sizes are given for FFT_REFERENCE_RATE, scale them with the sample rate so every band
+// keeps its frequency resolution and latency. Powers of two are rounded to the nearest power of two
+// as FFTW is fastest on those
+static int scale_fft_size(int size, unsigned int rate) {
+    double scaled = (double)size * rate / FFT_REFERENCE_RATE;
+    if ((size & (size - 1)) == 0)
+        size = 1 << (int)lround(log2(scaled));
+    else
+        size = 2 * (int)lround(scaled / 2);
+    return size < 16 ? 16 : size;
+}
+
+// dsp: part of the decimated rate the halfband filters keep free of aliases, a band is decimated
+// as long as twice its crossover stays below it. The last bar of a band usually reaches past the
+// crossover
+#define DECIMATED_BANDWIDTH 0.39
+
+// dsp: how often band b can be decimated by 2 at this rate. The FFT shrinks by the same factor, so
+// the bins keep their width while the transform gets cheaper
+static int band_level(const struct config_params *cfg, int b, int size, unsigned int rate) {
+    int level = 0;
+    if (!cfg->fft_decimation || b == cfg->fft_bands - 1)
+        return 0;
+    while (level + 1 < MAX_INPUT_LEVELS && (size >> (level + 1)) >= 16 &&
+           size % (2 << level) == 0 &&
+           2 * cfg->fft_crossover[b] <= DECIMATED_BANDWIDTH * rate / (2 << level))
+        level++;
+    return level;
+}
+
+static void start_channel_pool(int channels);
+static void stop_channel_pool(void);
+
+// dsp: allocate the FFT buffers and windows for the given sample rate and make the plans
+static void init_dsp(struct audio_data *audio, const struct config_params *cfg, unsigned int rate,
+                     const char *wisdomPath) {
+    unsigned int planner_flags = get_planner_flags(cfg->planner);
+    int channels = cfg->stereo ? 2 : 1;
+
+    audio->fft_band_count = cfg->fft_bands;
+    audio->fft_bands = (struct fft_band *)calloc(cfg->fft_bands, sizeof(struct fft_band));
+    audio->fft_channels = channels;
+    audio->input_buffer_size = scale_fft_size(cfg->fft_size[cfg->fft_bands - 1], rate);
+
+#ifdef FFTW_THREADS
+    FFTW(plan_with_nthreads)(cfg->fft_threads);
+#endif
+
+    // with channel threads every channel gets its own plan, so the channels can be executed
+    // independently
+    bool split = cfg->channel_threads && channels > 1;
+    fft_plan_count = split ? channels : 1;
+
+    for (int b = 0; b < audio->fft_band_count; b++) {
+        struct fft_band *band = &audio->fft_bands[b];
+        band->size = scale_fft_size(cfg->fft_size[b], rate);
+        band->level = band_level(cfg, b, band->size, rate);
+        band->size >>= band->level;
+
+        band->multiplier = (dsp_real *)malloc(band->size * sizeof(dsp_real));
+        for (int i = 0; i < band->size; i++)
+            band->multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (band->size - 1)));
+
+        band->in = FFTW(alloc_real)(band->size * channels);
+        fft_bins[b] = band->size / 2 + 1;
+        fft_out[b] = FFTW(alloc_complex)(fft_bins[b] * channels);
+        memset(fft_out[b], 0, fft_bins[b] * channels * sizeof(FFTW(complex)));
+
+        for (int c = 0; c < fft_plan_count; c++)
+            fft_plan[b][c] = plan_band(band->size, split ? 1 : channels, channels, band->in + c,
+                                       fft_out[b] + c * fft_bins[b], planner_flags);
+
+        for (int c = 0; c < channels; c++)
+            magnitude[c][b] = (dsp_real *)calloc(fft_bins[b], sizeof(dsp_real));
+
+        // planning with anything but FFTW_ESTIMATE overwrites the input arrays
+        memset(band->in, 0, sizeof(dsp_real) * band->size * channels);
+
+        debug("fft band %d: %d at %u Hz\n", b, band->size, rate >> band->level);
+    }
+
+    // fftw: keep what was measured for the next start
+    if (wisdomPath != NULL && cfg->planner != PLANNER_ESTIMATE)
+        FFTW(export_wisdom_to_filename)(wisdomPath);
+
+    if (split)
+        start_channel_pool(channels);
+}
+
+static void free_dsp(struct audio_data *audio) {
+    stop_channel_pool();
+
+    for (int b = 0; b < audio->fft_band_count; b++) {
+        free(audio->fft_bands[b].multiplier);
+        FFTW(free)(audio->fft_bands[b].in);
+        for (int c = 0; c < fft_plan_count; c++)
+            FFTW(destroy_plan)(fft_plan[b][c]);
+        FFTW(free)(fft_out[b]);
+        for (int c = 0; c < audio->fft_channels; c++)
+            free(magnitude[c][b]);
+    }
+    free(audio->fft_bands);
+    audio->fft_bands = NULL;
+    audio->fft_band_count = 0;
+}
+
+// input: the rate the FFT bands are sized for before the audio thread runs. alsa, shmem, sndio,
+// jack and replay only learn theirs from the stream and report it through set_input_rate(), until
+// then assume the one the previous stream had
+static unsigned int expected_rate(const struct config_params *cfg, unsigned int last_rate) {
+    switch (cfg->im) {
+    case INPUT_FIFO:
+    case INPUT_SYNTHETIC:
+    case INPUT_FILE:
+        return cfg->fifoSample;
+    case INPUT_ALSA:
+    case INPUT_SHMEM:
+    case INPUT_SNDIO:
+    case INPUT_JACK:
+    case INPUT_REPLAY:
+        return last_rate ? last_rate : FFT_REFERENCE_RATE;
+    default:
+        return FFT_REFERENCE_RATE;
+    }
+}
+
+// input: allocate the ring and start the audio thread, the ring is sized for the current FFT buffers
+static void start_input(struct audio_data *audio, pthread_t *p_thread) {
+#ifdef ALSA
+    struct timespec req = {.tv_sec = 0, .tv_nsec = 0};
+    int n;
+#endif
+
+    audio->source = malloc(1 + strlen(p.audio_source));
+    strcpy(audio->source, p.audio_source);
+
+    audio->format = -1;
+    audio->latency = p.input_latency;
+    audio->offline =
+        p.im == INPUT_FILE || ((p.im == INPUT_REPLAY || p.im == INPUT_SYNTHETIC) && p.speed == 0);
+    audio->framerate = p.framerate;
+    reset_offline(audio);
+    audio->input_rate = audio->rate;
+
+    // input: one recording goes on across restarts of the input as long as its path stays, every
+    // start notes the rate the input begins at
+    if (audio->recorder && strcmp(recording_path(audio->recorder), p.input_record) != 0) {
+        stop_recording(audio->recorder);
+        audio->recorder = NULL;
+    }
+    if (!audio->recorder && p.input_record[0] != '\0')
+        audio->recorder = start_recording(p.input_record);
+    if (audio->recorder)
+        record_rate(audio->recorder, audio->rate);
+    audio->terminate = 0;
+    if (p.stereo)
+        audio->channels = 2;
+    if (!p.stereo)
+        audio->channels = 1;
+    audio->average = false;
+    audio->left = false;
+    audio->right = false;
+    if (strcmp(p.mono_option, "average") == 0)
+        audio->average = true;
+    if (strcmp(p.mono_option, "left") == 0)
+        audio->left = true;
+    if (strcmp(p.mono_option, "right") == 0)
+        audio->right = true;
+
+    init_input_rings(audio);
+
+    debug("starting audio thread\n");
+    switch (p.im) {
+#ifdef ALSA
+    case INPUT_ALSA:
+        // input_alsa: wait for the input to be ready
+        if (is_loop_device_for_sure(audio->source)) {
+            if (directory_exists("/sys/")) {
+                if (!directory_exists("/sys/module/snd_aloop/")) {
+                    cleanup();
+                    fprintf(stderr,
+                            "Linux kernel module \"snd_aloop\" does not seem to  be loaded.\n"
+                            "Maybe run \"sudo modprobe snd_aloop\".\n");
+                    exit(EXIT_FAILURE);
+                }
             }
-            for (m_y = z + 1; m_y < number_of_bars; m_y++) {
-                de = m_y - z;
-                bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+        }
+
+        pthread_create(p_thread, NULL, input_alsa, (void *)audio); // starting alsamusic listener
+
+        n = 0;
+
+        while (audio->format == -1) {
+            req.tv_sec = 0;
+            req.tv_nsec = 1000000;
+            nanosleep(&req, NULL);
+            n++;
+            if (n > 2000) {
+                cleanup();
+                fprintf(stderr, "could not get rate and/or format, problems with audio thread? "
+                                "quiting...\n");
+                exit(EXIT_FAILURE);
             }
         }
+        debug("got format: %d\n", audio->format);
+        break;
+#endif
+    case INPUT_FIFO:
+        // starting fifomusic listener
+        audio->format = p.fifoSampleBits;
+        audio->fifo_format = p.fifo_format;
+        pthread_create(p_thread, NULL, input_fifo, (void *)audio);
+        break;
+#ifdef PULSE
+    case INPUT_PULSE:
+        // starting pulsemusic listener, it resolves source 'auto' to the default sink monitor
+        pthread_create(p_thread, NULL, input_pulse, (void *)audio);
+        break;
+#endif
+#ifdef SNDIO
+    case INPUT_SNDIO:
+        pthread_create(p_thread, NULL, input_sndio, (void *)audio);
+        break;
+#endif
+    case INPUT_SHMEM:
+        // the rate follows from the stream through set_input_rate()
+        pthread_create(p_thread, NULL, input_shmem, (void *)audio);
+        break;
+#ifdef PORTAUDIO
+    case INPUT_PORTAUDIO:
+        pthread_create(p_thread, NULL, input_portaudio, (void *)audio);
+        break;
+#endif
+#ifdef JACK
+    case INPUT_JACK:
+        // the rate is the server's, set through set_input_rate()
+        pthread_create(p_thread, NULL, input_jack, (void *)audio);
+        break;
+#endif
+    case INPUT_FILE:
+        // a wav file sets its own rate through set_input_rate()
+        audio->fifo_format = p.fifo_format;
+        pthread_create(p_thread, NULL, input_file, (void *)audio);
+        break;
+    case INPUT_REPLAY:
+        // the recording sets its rate through set_input_rate()
+        audio->speed = p.speed;
+        pthread_create(p_thread, NULL, input_replay, (void *)audio);
+        break;
+    case INPUT_SYNTHETIC:
+        // generates at the configured rate the FFT bands were sized for
+        audio->block_size = p.block_size;
+        audio->speed = p.speed;
+        pthread_create(p_thread, NULL, input_synthetic, (void *)audio);
+        break;
+    default:
+        exit(EXIT_FAILURE); // Can't happen.
+    }
+}
+
+static void stop_input(struct audio_data *audio, pthread_t p_thread) {
+    struct timespec req = {.tv_sec = 0, .tv_nsec = 100};
+    nanosleep(&req, NULL); // waiting some time to make sure audio is ready
+
+    //**telling audio thread to terminate**//
+    audio->terminate = 1;
+    pthread_join(p_thread, NULL);
+
+    free(audio->source);
+    free_input_rings(audio);
+    free_goertzel_banks(audio);
+}
+
+// dsp: the audio thread reported a new sample rate and waits in set_input_rate() without touching
+// the rings, so the bands and the rings can be rebuilt for it in place. The rate is published last,
+// from then on the audio thread writes to the new rings
+static void change_rate(struct audio_data *audio, const struct config_params *cfg,
+                        unsigned int rate, const char *wisdomPath) {
+    bool resize = false;
+    for (int b = 0; b < cfg->fft_bands; b++) {
+        struct fft_band *band = &audio->fft_bands[b];
+        int size = scale_fft_size(cfg->fft_size[b], rate);
+        resize |= size != band->size << band->level ||
+                  band_level(cfg, b, size, rate) != band->level;
+    }
+
+    debug("input rate changed from %u to %u Hz\n", audio->rate, rate);
+    if (resize) {
+        free_dsp(audio);
+        free_input_rings(audio);
+        init_dsp(audio, cfg, rate, wisdomPath);
+        init_input_rings(audio);
+    }
+    __atomic_store_n(&audio->rate, rate, __ATOMIC_RELEASE);
+}
+
+// general: sleep until the absolute deadline of the next frame, so the time spent on FFT and drawing
+// does not add to the frame period. If we fell more than a frame behind, start counting from now
+// instead of rendering a burst of late frames
+static void wait_for_next_frame(struct timespec *deadline, long period_ns) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    deadline->tv_sec += period_ns / 1000000000;
+    deadline->tv_nsec += period_ns % 1000000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+
+    long long late_ns = (long long)(now.tv_sec - deadline->tv_sec) * 1000000000 +
+                        (now.tv_nsec - deadline->tv_nsec);
+    if (late_ns > period_ns) {
+        *deadline = now;
+        return;
+    }
+    if (late_ns >= 0)
+        return;
+
+#ifndef NORT
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+#else
+    struct timespec req = {.tv_sec = -late_ns / 1000000000, .tv_nsec = -late_ns % 1000000000};
+    nanosleep(&req, NULL);
+#endif
+}
+
+// process: turn the cut-off tables into one bin range per bar and find which bins of each band are
+// in use at all, so the per frame work is a straight pass over each
+static void compile_bar_bins(struct bar_bins *bins, int number_of_bars, const int *lower_cut_off,
+                             const int *upper_cut_off, const int *bar_band, int band_count,
+                             int used_first[MAX_FFT_BANDS], int used_last[MAX_FFT_BANDS]) {
+    for (int b = 0; b < band_count; b++) {
+        used_first[b] = INT_MAX;
+        used_last[b] = -1;
+    }
+
+    for (int n = 0; n < number_of_bars; n++) {
+        // a decimated band has fewer bins than its bar tables were laid out for
+        int last = upper_cut_off[n] < fft_bins[bar_band[n]] ? upper_cut_off[n]
+                                                             : fft_bins[bar_band[n]] - 1;
+        bins[n].band = bar_band[n];
+        bins[n].first = lower_cut_off[n];
+        bins[n].count = last - lower_cut_off[n] + 1;
+        if (bins[n].count < 0)
+            bins[n].count = 0;
+        bins[n].weight = bins[n].count > 0 ? 1.0 / bins[n].count : 0;
+
+        if (bins[n].count > 0) {
+            int b = bins[n].band;
+            if (bins[n].first < used_first[b])
+                used_first[b] = bins[n].first;
+            if (bins[n].first + bins[n].count - 1 > used_last[b])
+                used_last[b] = bins[n].first + bins[n].count - 1;
+        }
+    }
+}
+
+// process [goertzel]: a filter per bar at its centre frequency, run by the audio thread on the full
+// rate input over blocks of two periods of the bar's bandwidth. Scaled so broadband audio gives the
+// same heights as averaging the bins of the bar's band. number_of_bars = 0 gives an empty bank that
+// stops the filters
+static struct goertzel_bank *compile_goertzel_bank(const struct bar_bins *bins, int number_of_bars,
+                                                   const float *cut_off_frequency,
+                                                   const struct audio_data *audio) {
+    double omega[256], scale[256];
+    int length[256];
+
+    for (int n = 0; n < number_of_bars; n++) {
+        const struct fft_band *band = &audio->fft_bands[bins[n].band];
+        int window = band->size << band->level;
+        double lower = cut_off_frequency[n], upper = cut_off_frequency[n + 1];
+        omega[n] = 2 * M_PI * sqrt(lower * upper) / audio->rate;
+        length[n] = upper > lower ? 2 * audio->rate / (upper - lower) : window;
+        if (length[n] > window)
+            length[n] = window;
+        if (length[n] < 8)
+            length[n] = 8;
+        length[n] &= ~1;
+        scale[n] = band->size / sqrt((double)window * length[n]);
+    }
+    return new_goertzel_bank(number_of_bars, omega, length, scale);
+}
+
+// process: |X| for a range of bins. Written without hypot() and branches so the compiler can
+// vectorise the squares and the square root
+static void compute_magnitudes(dsp_real *restrict magnitude, const FFTW(complex) *restrict out,
+                               int first, int last) {
+    for (int i = first; i <= last; i++)
+        magnitude[i] = dsp_sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1]);
+}
+
+static void sum_bar_bins(dsp_real *temp, dsp_real *const magnitude[MAX_FFT_BANDS],
+                         const struct bar_bins *bins, int number_of_bars) {
+    for (int n = 0; n < number_of_bars; n++) {
+        const dsp_real *m = magnitude[bins[n].band] + bins[n].first;
+        dsp_real sum = 0;
+        for (int i = 0; i < bins[n].count; i++)
+            sum += m[i];
+        temp[n] = sum * bins[n].weight;
+    }
+}
+
+// process [smoothing]: monstercat lets every bar spread bars[z] / monstercat^distance to the bars
+// around it. The ratio between two sources is the same at every distance, so an earlier bar only has
+// to be tracked while it is as strong as the strongest source. Sources that are equally strong up to
+// the rounding of pow() are all kept, so the result matches spreading from every bar. Going forward
+// a bar spreads what the bars before it raised it to, going back it spreads what the forward pass
+// left
+#define MONSTERCAT_TIE (1 - 1e-9)
+
+static void monstercat_spread(int *bars, int number_of_bars, int step, bool chained,
+                              const double *decay) {
+    int sources[256], count = 0;
+    double spread[256];
+    int start = step > 0 ? 0 : number_of_bars - 1;
+
+    for (int z = start; z >= 0 && z < number_of_bars; z += step) {
+        int own = bars[z];
+        double strongest = own;
+        for (int i = 0; i < count; i++) {
+            spread[i] = bars[sources[i]] / decay[abs(z - sources[i])];
+            if (spread[i] > bars[z])
+                bars[z] = spread[i];
+            if (spread[i] > strongest)
+                strongest = spread[i];
+        }
+
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (spread[i] > 0 && spread[i] >= strongest * MONSTERCAT_TIE)
+                sources[kept++] = sources[i];
+        }
+        count = kept;
+        if (chained)
+            own = bars[z];
+        if (own > 0 && own >= strongest * MONSTERCAT_TIE)
+            sources[count++] = z;
+    }
+}
+
+// process [smoothing]: waves lets every bar spread bars[z] - distance^2 to the bars around it. Once
+// the common -x^2 is taken out each source is a line in x with slope 2 * source, so the strongest
+// source at x is found on the upper hull of those lines. Sources are added with increasing slope
+// and queried at increasing x, so the hull is a deque (x is counted from the start of the pass)
+struct wave_source {
+    int x, value;
+};
+
+static long long wave_at(struct wave_source s, int x) {
+    return s.value - (long long)(x - s.x) * (x - s.x);
+}
+
+// true if b never beats both a and c, for a.x < b.x < c.x
+static bool wave_hidden(struct wave_source a, struct wave_source b, struct wave_source c) {
+    // b beats a from x >= num_ab / den_ab on, c beats b from x >= num_bc / den_bc on
+    long long num_ab = (long long)a.value - b.value + b.x * b.x - a.x * a.x;
+    long long den_ab = 2 * (b.x - a.x);
+    long long num_bc = (long long)b.value - c.value + c.x * c.x - b.x * b.x;
+    long long den_bc = 2 * (c.x - b.x);
+    return num_bc * den_ab <= num_ab * den_bc;
+}
+
+static void waves_spread(int *bars, int number_of_bars, int step, bool attenuate) {
+    struct wave_source hull[256];
+    int front = 0, back = 0;
+    int start = step > 0 ? 0 : number_of_bars - 1;
+
+    for (int x = 0; x < number_of_bars; x++) {
+        int z = start + x * step;
+        int own = bars[z];
+
+        while (back - front >= 2 && wave_at(hull[front + 1], x) >= wave_at(hull[front], x))
+            front++;
+        if (back > front && wave_at(hull[front], x) > bars[z])
+            bars[z] = wave_at(hull[front], x);
+
+        // going forward a bar is attenuated after the bars before it have spread into it and
+        // spreads the attenuated value
+        if (attenuate) {
+            bars[z] = bars[z] / 1.25;
+            own = bars[z];
+        }
+
+        struct wave_source source = {x, own};
+        while (back - front >= 2 && wave_hidden(hull[back - 2], hull[back - 1], source))
+            back--;
+        hull[back++] = source;
+    }
+}
+
+// process [smoothing]: pow(monstercat, distance) for every distance a bar can spread over, filled
+// on the main thread when the config is applied so channel threads only read it
+static double monstercat_decay[256];
+
+static void init_monstercat_decay(double monstercat) {
+    for (int de = 0; de < 256; de++)
+        monstercat_decay[de] = pow(monstercat, de);
+}
+
+int *monstercat_filter(int *bars, int number_of_bars, int waves, double monstercat) {
+
+    // process [smoothing]: monstercat-style "average"
+
+    if (waves > 0) {
+        waves_spread(bars, number_of_bars, 1, true);
+        waves_spread(bars, number_of_bars, -1, false);
     } else if (monstercat > 0) {
-        for (z = 0; z < number_of_bars; z++) {
-            // if (bars[z] < 1)bars[z] = 1;
-            for (m_y = z - 1; m_y >= 0; m_y--) {
-                de = z - m_y;
-                bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
-            }
-            for (m_y = z + 1; m_y < number_of_bars; m_y++) {
-                de = m_y - z;
-                bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
+        monstercat_spread(bars, number_of_bars, 1, true, monstercat_decay);
+        monstercat_spread(bars, number_of_bars, -1, false, monstercat_decay);
+    }
+
+    return bars;
+}
+
+// process: what one channel needs for a frame, from its FFT output to the smoothed bar heights
+struct channel_frame {
+    int number_of_bars; // per channel
+    int band_count;
+    bool band_due[MAX_FFT_BANDS]; // bands with enough new audio to be transformed again
+    enum analysis analysis;
+    const struct bar_bins *bins;
+    const int *used_first, *used_last;
+    const dsp_real *eq;
+    double sens, ignore, monstercat;
+    int waves;
+    dsp_real *temp[MAX_CHANNELS];
+    int *bars[MAX_CHANNELS];
+};
+
+static void process_channel(int c, const struct channel_frame *frame) {
+    // process: separate frequency bands, a band that is not due keeps its last magnitudes
+    for (int b = 0; b < frame->band_count; b++) {
+        if (!frame->band_due[b])
+            continue;
+        if (fft_plan_count > 1)
+            FFTW(execute)(fft_plan[b][c]);
+        if (frame->analysis == ANALYSIS_FFT)
+            compute_magnitudes(magnitude[c][b], fft_out[b] + c * fft_bins[b],
+                               frame->used_first[b], frame->used_last[b]);
+    }
+
+    // process: add upp FFT values within bands, goertzel bars were read before the frame
+    dsp_real *temp = frame->temp[c];
+    if (frame->analysis == ANALYSIS_FFT)
+        sum_bar_bins(temp, magnitude[c], frame->bins, frame->number_of_bars);
+
+    for (int n = 0; n < frame->number_of_bars; n++) {
+        // getting average multiply with sens and eq
+        temp[n] *= frame->sens * frame->eq[n];
+
+        if (temp[n] <= frame->ignore)
+            temp[n] = 0;
+
+        frame->bars[c][n] = temp[n];
+    }
+
+    // process [filter]
+    if (frame->monstercat)
+        monstercat_filter(frame->bars[c], frame->number_of_bars, frame->waves, frame->monstercat);
+}
+
+// process: persistent workers for channels 1.. of a frame, the main thread does channel 0 and
+// then waits for the workers at the end of the frame
+struct channel_pool {
+    pthread_t threads[MAX_CHANNELS - 1];
+    int workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned int frame_count; // frames handed out so far
+    int pending;              // workers still busy with the current frame
+    bool quit;
+    const struct channel_frame *frame;
+};
+
+static struct channel_pool pool = {.workers = 0};
+
+static void *channel_worker(void *arg) {
+    int c = (int)(intptr_t)arg;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        while (pool.frame_count == seen && !pool.quit)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        if (pool.quit)
+            break;
+        seen = pool.frame_count;
+        const struct channel_frame *frame = pool.frame;
+        pthread_mutex_unlock(&pool.lock);
+
+        process_channel(c, frame);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static void start_channel_pool(int channels) {
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.start, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pool.frame_count = 0;
+    pool.pending = 0;
+    pool.quit = false;
+    pool.workers = 0;
+    for (int c = 1; c < channels; c++) {
+        if (pthread_create(&pool.threads[pool.workers], NULL, channel_worker, (void *)(intptr_t)c))
+            break;
+        pool.workers++;
+    }
+}
+
+static void stop_channel_pool(void) {
+    if (pool.workers == 0)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.workers; i++)
+        pthread_join(pool.threads[i], NULL);
+    pool.workers = 0;
+
+    pthread_cond_destroy(&pool.start);
+    pthread_cond_destroy(&pool.done);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+// process: run every channel of a frame, on the pool if there is one
+static void process_frame(const struct channel_frame *frame, int channels) {
+    if (pool.workers == 0) {
+        if (fft_plan_count == 1) {
+            for (int b = 0; b < frame->band_count; b++) {
+                if (frame->band_due[b])
+                    FFTW(execute)(fft_plan[b][0]);
             }
         }
+        for (int c = 0; c < channels; c++)
+            process_channel(c, frame);
+        return;
     }
 
-    return bars;
+    pthread_mutex_lock(&pool.lock);
+    pool.frame = frame;
+    pool.pending = pool.workers;
+    pool.frame_count++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    process_channel(0, frame);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
 }
 
 // general: entry point
@@ -193,29 +888,36 @@ int main(int argc, char **argv) {
 
     // general: define variables
     pthread_t p_thread;
-    int thr_id GCC_UNUSED;
+    bool input_running = false, dsp_ready = false;
     float cut_off_frequency[256];
     float upper_cut_off_frequency[256];
     float relative_cut_off[256];
     double center_frequencies[256];
     int bars[256], FFTbuffer_lower_cut_off[256], FFTbuffer_upper_cut_off[256];
-    int *bars_left, *bars_right;
-    double *temp_l, *temp_r;
+    int bars_left[256], bars_right[256];
+    dsp_real temp_l[256], temp_r[256];
     int bars_mem[256];
     int bars_last[256];
     int previous_frame[256];
     int sleep_counter = 0;
-    int n, height, lines, width, c, rest, inAtty, fp, fptest, rc;
+    int n, height, lines, width, c, rest, inAtty, rc;
+    int fp = -1, fptest = -1;
     bool silence = false;
     // int cont = 1;
     int fall[256];
+    struct goertzel_bank *goertzel_bank = NULL;
     // float temp;
     float bars_peak[256];
-    double eq[256];
+    dsp_real eq[256];
+    // frames of new audio since each FFT band was last transformed, and how many it waits for
+    unsigned int fft_frames[MAX_FFT_BANDS], fft_hop[MAX_FFT_BANDS];
     float g;
-    struct timespec req = {.tv_sec = 0, .tv_nsec = 0};
+    struct timespec frame_deadline;
+    long frame_period;
     struct timespec sleep_mode_timer = {.tv_sec = 1, .tv_nsec = 0};
     char configPath[PATH_MAX];
+    char wisdomPath[PATH_MAX];
+    bool have_wisdom_path;
     char *usage = "\n\
 Usage : " PACKAGE " [options]\n\
 Visualize audio input in terminal. \n\
@@ -243,6 +945,7 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
 
     struct audio_data audio;
     memset(&audio, 0, sizeof(audio));
+    init_input_wakeup(&audio);
 
 #ifndef NDEBUG
     int maxvalue = 0;
@@ -284,6 +987,16 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
         n = 0;
     }
 
+#ifdef FFTW_THREADS
+    // fftw: lets fft_threads split every transform over several threads
+    FFTW(init_threads)();
+#endif
+
+    // fftw: load plans measured by earlier runs
+    have_wisdom_path = get_wisdom_path(wisdomPath, sizeof(wisdomPath));
+    if (have_wisdom_path && !FFTW(import_wisdom_from_filename)(wisdomPath))
+        debug("no fftw wisdom loaded from %s\n", wisdomPath);
+
     // general: main loop
     while (1) {
 
@@ -291,11 +1004,21 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
         // config: load
         struct error_s error;
         error.length = 0;
-        if (!load_config(configPath, &p, 0, &error)) {
+        struct config_params new_p;
+        memset(&new_p, 0, sizeof(new_p));
+        if (!load_config(configPath, &new_p, 0, &error)) {
             fprintf(stderr, "Error loading config. %s\n", error.message);
             exit(EXIT_FAILURE);
         }
 
+        // config: find out what a reload has to rebuild
+        int changes = CONFIG_CHANGED_RENDER | CONFIG_CHANGED_DSP | CONFIG_CHANGED_INPUT;
+        if (input_running) {
+            changes = config_changes(&p, &new_p);
+            free_config(&p);
+        }
+        p = new_p;
+
         output_mode = p.om;
 
 #ifdef ARTNET
@@ -331,200 +1054,31 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 setlocale(LC_ALL, "");
         }
 
-        // input: init
-        int bass_cut_off = 150;
-        int treble_cut_off = 2500;
-
-        audio.source = malloc(1 + strlen(p.audio_source));
-        strcpy(audio.source, p.audio_source);
-
-        audio.format = -1;
-        audio.rate = 0;
-        audio.FFTbassbufferSize = 4096;
-        audio.FFTmidbufferSize = 2048;
-        audio.FFTtreblebufferSize = 1024;
-        audio.terminate = 0;
-        if (p.stereo)
-            audio.channels = 2;
-        if (!p.stereo)
-            audio.channels = 1;
-        audio.average = false;
-        audio.left = false;
-        audio.right = false;
-        if (strcmp(p.mono_option, "average") == 0)
-            audio.average = true;
-        if (strcmp(p.mono_option, "left") == 0)
-            audio.left = true;
-        if (strcmp(p.mono_option, "right") == 0)
-            audio.right = true;
-        audio.bass_index = 0;
-        audio.mid_index = 0;
-        audio.treble_index = 0;
-        audio.bass_multiplier = (double *)malloc(audio.FFTbassbufferSize * sizeof(double));
-        audio.mid_multiplier = (double *)malloc(audio.FFTmidbufferSize * sizeof(double));
-        audio.treble_multiplier = (double *)malloc(audio.FFTtreblebufferSize * sizeof(double));
-
-        temp_l = (double *)malloc((audio.FFTbassbufferSize / 2 + 1) * sizeof(double));
-        temp_r = (double *)malloc((audio.FFTbassbufferSize / 2 + 1) * sizeof(double));
-
-        bars_left = (int *)malloc(256 * sizeof(int));
-        bars_right = (int *)malloc(256 * sizeof(int));
-
-        for (int i = 0; i < audio.FFTbassbufferSize; i++) {
-            audio.bass_multiplier[i] =
-                0.5 * (1 - cos(2 * M_PI * i / (audio.FFTbassbufferSize - 1)));
+        // only tear down what the changed keys need, so a reload that only touches rendering or
+        // smoothing keeps the audio thread and the FFT plans running
+        // dsp: a restarted input may deliver another rate, the FFT sizes have to follow it
+        unsigned int rate = audio.rate;
+        if (changes & CONFIG_CHANGED_INPUT)
+            rate = expected_rate(&p, audio.rate);
+        if (rate != audio.rate)
+            changes |= CONFIG_CHANGED_DSP;
+
+        if (input_running && (changes & CONFIG_CHANGED_INPUT)) {
+            stop_input(&audio, p_thread);
+            input_running = false;
         }
-        for (int i = 0; i < audio.FFTmidbufferSize; i++) {
-            audio.mid_multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (audio.FFTmidbufferSize - 1)));
+        if (dsp_ready && (changes & CONFIG_CHANGED_DSP)) {
+            free_dsp(&audio);
+            dsp_ready = false;
         }
-        for (int i = 0; i < audio.FFTtreblebufferSize; i++) {
-            audio.treble_multiplier[i] =
-                0.5 * (1 - cos(2 * M_PI * i / (audio.FFTtreblebufferSize - 1)));
+        if (!dsp_ready) {
+            init_dsp(&audio, &p, rate, have_wisdom_path ? wisdomPath : NULL);
+            dsp_ready = true;
         }
-        // BASS
-        // audio.FFTbassbufferSize =  audio.rate / 20; // audio.FFTbassbufferSize;
-
-        audio.in_bass_r = fftw_alloc_real(audio.FFTbassbufferSize);
-        audio.in_bass_l = fftw_alloc_real(audio.FFTbassbufferSize);
-        audio.in_bass_r_raw = fftw_alloc_real(audio.FFTbassbufferSize);
-        audio.in_bass_l_raw = fftw_alloc_real(audio.FFTbassbufferSize);
-
-        out_bass_l = fftw_alloc_complex(audio.FFTbassbufferSize / 2 + 1);
-        out_bass_r = fftw_alloc_complex(audio.FFTbassbufferSize / 2 + 1);
-        memset(out_bass_l, 0, (audio.FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-        memset(out_bass_r, 0, (audio.FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-
-        p_bass_l = fftw_plan_dft_r2c_1d(audio.FFTbassbufferSize, audio.in_bass_l, out_bass_l,
-                                        FFTW_MEASURE);
-        p_bass_r = fftw_plan_dft_r2c_1d(audio.FFTbassbufferSize, audio.in_bass_r, out_bass_r,
-                                        FFTW_MEASURE);
-
-        // MID
-        // audio.FFTmidbufferSize =  audio.rate / bass_cut_off; // audio.FFTbassbufferSize;
-        audio.in_mid_r = fftw_alloc_real(audio.FFTmidbufferSize);
-        audio.in_mid_l = fftw_alloc_real(audio.FFTmidbufferSize);
-        audio.in_mid_r_raw = fftw_alloc_real(audio.FFTmidbufferSize);
-        audio.in_mid_l_raw = fftw_alloc_real(audio.FFTmidbufferSize);
-
-        out_mid_l = fftw_alloc_complex(audio.FFTmidbufferSize / 2 + 1);
-        out_mid_r = fftw_alloc_complex(audio.FFTmidbufferSize / 2 + 1);
-        memset(out_mid_l, 0, (audio.FFTmidbufferSize / 2 + 1) * sizeof(fftw_complex));
-        memset(out_mid_r, 0, (audio.FFTmidbufferSize / 2 + 1) * sizeof(fftw_complex));
-
-        p_mid_l =
-            fftw_plan_dft_r2c_1d(audio.FFTmidbufferSize, audio.in_mid_l, out_mid_l, FFTW_MEASURE);
-        p_mid_r =
-            fftw_plan_dft_r2c_1d(audio.FFTmidbufferSize, audio.in_mid_r, out_mid_r, FFTW_MEASURE);
-
-        // TRIEBLE
-        // audio.FFTtreblebufferSize =  audio.rate / treble_cut_off; // audio.FFTbassbufferSize;
-        audio.in_treble_r = fftw_alloc_real(audio.FFTtreblebufferSize);
-        audio.in_treble_l = fftw_alloc_real(audio.FFTtreblebufferSize);
-        audio.in_treble_r_raw = fftw_alloc_real(audio.FFTtreblebufferSize);
-        audio.in_treble_l_raw = fftw_alloc_real(audio.FFTtreblebufferSize);
-
-        out_treble_l = fftw_alloc_complex(audio.FFTtreblebufferSize / 2 + 1);
-        out_treble_r = fftw_alloc_complex(audio.FFTtreblebufferSize / 2 + 1);
-        memset(out_treble_l, 0, (audio.FFTtreblebufferSize / 2 + 1) * sizeof(fftw_complex));
-        memset(out_treble_r, 0, (audio.FFTtreblebufferSize / 2 + 1) * sizeof(fftw_complex));
-
-        p_treble_l = fftw_plan_dft_r2c_1d(audio.FFTtreblebufferSize, audio.in_treble_l,
-                                          out_treble_l, FFTW_MEASURE);
-        p_treble_r = fftw_plan_dft_r2c_1d(audio.FFTtreblebufferSize, audio.in_treble_r,
-                                          out_treble_r, FFTW_MEASURE);
-
-        debug("got buffer size: %d, %d, %d", audio.FFTbassbufferSize, audio.FFTmidbufferSize,
-              audio.FFTtreblebufferSize);
-
-        reset_output_buffers(&audio);
-
-        debug("starting audio thread\n");
-        switch (p.im) {
-#ifdef ALSA
-        case INPUT_ALSA:
-            // input_alsa: wait for the input to be ready
-            if (is_loop_device_for_sure(audio.source)) {
-                if (directory_exists("/sys/")) {
-                    if (!directory_exists("/sys/module/snd_aloop/")) {
-                        cleanup();
-                        fprintf(stderr,
-                                "Linux kernel module \"snd_aloop\" does not seem to  be loaded.\n"
-                                "Maybe run \"sudo modprobe snd_aloop\".\n");
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            }
-
-            thr_id = pthread_create(&p_thread, NULL, input_alsa,
-                                    (void *)&audio); // starting alsamusic listener
-
-            n = 0;
-
-            while (audio.format == -1 || audio.rate == 0) {
-                req.tv_sec = 0;
-                req.tv_nsec = 1000000;
-                nanosleep(&req, NULL);
-                n++;
-                if (n > 2000) {
-                    cleanup();
-                    fprintf(stderr, "could not get rate and/or format, problems with audio thread? "
-                                    "quiting...\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-            debug("got format: %d and rate %d\n", audio.format, audio.rate);
-            break;
-#endif
-        case INPUT_FIFO:
-            // starting fifomusic listener
-            thr_id = pthread_create(&p_thread, NULL, input_fifo, (void *)&audio);
-            audio.rate = p.fifoSample;
-            audio.format = p.fifoSampleBits;
-            break;
-#ifdef PULSE
-        case INPUT_PULSE:
-            if (strcmp(audio.source, "auto") == 0) {
-                getPulseDefaultSink((void *)&audio);
-            }
-            // starting pulsemusic listener
-            thr_id = pthread_create(&p_thread, NULL, input_pulse, (void *)&audio);
-            audio.rate = 44100;
-            break;
-#endif
-#ifdef SNDIO
-        case INPUT_SNDIO:
-            thr_id = pthread_create(&p_thread, NULL, input_sndio, (void *)&audio);
-            audio.rate = 44100;
-            break;
-#endif
-        case INPUT_SHMEM:
-            thr_id = pthread_create(&p_thread, NULL, input_shmem, (void *)&audio);
-
-            n = 0;
-
-            while (audio.rate == 0) {
-                req.tv_sec = 0;
-                req.tv_nsec = 1000000;
-                nanosleep(&req, NULL);
-                n++;
-                if (n > 2000) {
-                    cleanup();
-                    fprintf(stderr, "could not get rate and/or format, problems with audio thread? "
-                                    "quiting...\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-            debug("got format: %d and rate %d\n", audio.format, audio.rate);
-            // audio.rate = 44100;
-            break;
-#ifdef PORTAUDIO
-        case INPUT_PORTAUDIO:
-            thr_id = pthread_create(&p_thread, NULL, input_portaudio, (void *)&audio);
-            audio.rate = 44100;
-            break;
-#endif
-        default:
-            exit(EXIT_FAILURE); // Can't happen.
+        __atomic_store_n(&audio.rate, rate, __ATOMIC_RELEASE);
+        if (!input_running) {
+            start_input(&audio, &p_thread);
+            input_running = true;
         }
 
         if (p.upper_cut_off > audio.rate / 2) {
@@ -572,6 +1126,13 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 break;
 
             case OUTPUT_RAW:
+                // don't leak the descriptors of the previous reload or resize
+                if (fp != -1)
+                    close(fp);
+                if (fptest != -1)
+                    close(fptest);
+                fp = fptest = -1;
+
                 if (strcmp(p.raw_target, "/dev/stdout") != 0) {
                     // checking if file exists
                     if (access(p.raw_target, F_OK) != -1) {
@@ -677,11 +1238,9 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                                         (1 / ((float)number_of_bars + 1) - 1);
 
             // process: calculate cutoff frequencies and eq
-            int bass_cut_off_bar = -1;
-            int treble_cut_off_bar = -1;
+            int bar_band[number_of_bars + 1];
             bool first_bar = true;
-            int first_treble_bar = 0;
-            int bar_buffer[number_of_bars + 1];
+            int lowest_crossover = p.fft_bands > 1 ? p.fft_crossover[0] : 0;
 
             for (n = 0; n < number_of_bars + 1; n++) {
                 double bar_distribution_coefficient = frequency_constant * (-1);
@@ -691,7 +1250,7 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
 
                 if (n > 0) {
                     if (cut_off_frequency[n - 1] >= cut_off_frequency[n] &&
-                        cut_off_frequency[n - 1] > bass_cut_off)
+                        cut_off_frequency[n - 1] > lowest_crossover)
                         cut_off_frequency[n] =
                             cut_off_frequency[n - 1] +
                             (cut_off_frequency[n - 1] - cut_off_frequency[n - 2]);
@@ -711,51 +1270,31 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 if (p.userEQ_enabled)
                     eq[n] *= p.userEQ[(int)floor(((double)n) * userEQ_keys_to_bars_ratio)];
 
-                eq[n] /= log2(audio.FFTbassbufferSize);
-
-                if (cut_off_frequency[n] < bass_cut_off) {
-                    // BASS
-                    bar_buffer[n] = 1;
-                    FFTbuffer_lower_cut_off[n] =
-                        relative_cut_off[n] * (audio.FFTbassbufferSize / 2);
-                    bass_cut_off_bar++;
-                    treble_cut_off_bar++;
-                    if (bass_cut_off_bar > 0)
-                        first_bar = false;
-
-                    eq[n] *= log2(audio.FFTbassbufferSize);
-                } else if (cut_off_frequency[n] > bass_cut_off &&
-                           cut_off_frequency[n] < treble_cut_off) {
-                    // MID
-                    bar_buffer[n] = 2;
-                    FFTbuffer_lower_cut_off[n] = relative_cut_off[n] * (audio.FFTmidbufferSize / 2);
-                    treble_cut_off_bar++;
-                    if ((treble_cut_off_bar - bass_cut_off_bar) == 1) {
-                        first_bar = true;
-                        FFTbuffer_upper_cut_off[n - 1] =
-                            relative_cut_off[n] * (audio.FFTbassbufferSize / 2);
-                    } else {
-                        first_bar = false;
-                    }
-
-                    eq[n] *= log2(audio.FFTmidbufferSize);
+                eq[n] /= log2(p.fft_size[0]);
+
+                // a bar belongs to the first band whose crossover is above it
+                int band = 0;
+                while (band < p.fft_bands - 1 && cut_off_frequency[n] >= p.fft_crossover[band])
+                    band++;
+                bar_band[n] = band;
+                // bins have the width of an undecimated FFT of band_size
+                int band_size = audio.fft_bands[band].size << audio.fft_bands[band].level;
+
+                FFTbuffer_lower_cut_off[n] = relative_cut_off[n] * (band_size / 2);
+                if (n > 0 && band != bar_band[n - 1]) {
+                    // first bar of a band, the bar before it ends where this one starts
+                    first_bar = true;
+                    struct fft_band *prev = &audio.fft_bands[bar_band[n - 1]];
+                    FFTbuffer_upper_cut_off[n - 1] =
+                        relative_cut_off[n] * ((prev->size << prev->level) / 2);
                 } else {
-                    // TREBLE
-                    bar_buffer[n] = 3;
-                    FFTbuffer_lower_cut_off[n] =
-                        relative_cut_off[n] * (audio.FFTtreblebufferSize / 2);
-                    first_treble_bar++;
-                    if (first_treble_bar == 1) {
-                        first_bar = true;
-                        FFTbuffer_upper_cut_off[n - 1] =
-                            relative_cut_off[n] * (audio.FFTmidbufferSize / 2);
-                    } else {
-                        first_bar = false;
-                    }
-
-                    eq[n] *= log2(audio.FFTtreblebufferSize);
+                    first_bar = n == 0;
                 }
 
+                // the FFT output grows with its size, keep the bar heights the same however far
+                // the sizes were scaled for the sample rate or decimated
+                eq[n] *= log2(p.fft_size[band]) * p.fft_size[band] / audio.fft_bands[band].size;
+
                 if (n > 0) {
                     if (!first_bar) {
                         FFTbuffer_upper_cut_off[n - 1] = FFTbuffer_lower_cut_off[n] - 1;
@@ -767,15 +1306,8 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                             FFTbuffer_lower_cut_off[n] = FFTbuffer_lower_cut_off[n - 1] + 1;
                             FFTbuffer_upper_cut_off[n - 1] = FFTbuffer_lower_cut_off[n] - 1;
 
-                            if (bar_buffer[n] == 1)
-                                relative_cut_off[n] = (float)(FFTbuffer_lower_cut_off[n]) /
-                                                      ((float)audio.FFTbassbufferSize / 2);
-                            else if (bar_buffer[n] == 2)
-                                relative_cut_off[n] = (float)(FFTbuffer_lower_cut_off[n]) /
-                                                      ((float)audio.FFTmidbufferSize / 2);
-                            else if (bar_buffer[n] == 3)
-                                relative_cut_off[n] = (float)(FFTbuffer_lower_cut_off[n]) /
-                                                      ((float)audio.FFTtreblebufferSize / 2);
+                            relative_cut_off[n] =
+                                (float)(FFTbuffer_lower_cut_off[n]) / ((float)band_size / 2);
 
                             cut_off_frequency[n] = relative_cut_off[n] * ((float)audio.rate / 2);
                         }
@@ -794,14 +1326,39 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 curs_set(0);
                 timeout(0);
                 if (n != 0) {
-                    mvprintw(n, 0, "%d: %f -> %f (%d -> %d) bass: %d, treble:%d \n", n,
+                    mvprintw(n, 0, "%d: %f -> %f (%d -> %d) band: %d \n", n,
                              cut_off_frequency[n - 1], cut_off_frequency[n],
                              FFTbuffer_lower_cut_off[n - 1], FFTbuffer_upper_cut_off[n - 1],
-                             bass_cut_off_bar, treble_cut_off_bar);
+                             bar_band[n - 1]);
                 }
 #endif
             }
 
+            struct bar_bins bar_bins[256];
+            int used_first[MAX_FFT_BANDS], used_last[MAX_FFT_BANDS];
+            compile_bar_bins(bar_bins, number_of_bars, FFTbuffer_lower_cut_off,
+                             FFTbuffer_upper_cut_off, bar_band, p.fft_bands, used_first,
+                             used_last);
+
+            // process: with few enough bars per channel a goertzel filter per bar is cheaper than
+            // the FFTs
+            enum analysis analysis = p.analysis;
+            if (number_of_bars <= p.goertzel_bars)
+                analysis = ANALYSIS_GOERTZEL;
+            goertzel_bank = compile_goertzel_bank(
+                bar_bins, analysis == ANALYSIS_GOERTZEL ? number_of_bars : 0, cut_off_frequency,
+                &audio);
+            set_goertzel_bank(&audio, goertzel_bank);
+
+            // process: a band is transformed again once (100 - overlap)% of its FFT size of new
+            // audio has arrived, start with all of them due
+            for (int b = 0; b < p.fft_bands; b++) {
+                unsigned int window = audio.fft_bands[b].size << audio.fft_bands[b].level;
+                fft_hop[b] = window * (100 - p.fft_overlap[b]) / 100;
+                fft_frames[b] = fft_hop[b];
+            }
+            init_monstercat_decay(p.monstercat);
+
             if (p.stereo)
                 number_of_bars = number_of_bars * 2;
             int x_axis_info = 0;
@@ -863,12 +1420,8 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
             bool resizeTerminal = false;
             // fcntl(0, F_SETFL, O_NONBLOCK);
 
-            if (p.framerate <= 1) {
-                req.tv_sec = 1 / (float)p.framerate;
-            } else {
-                req.tv_sec = 0;
-                req.tv_nsec = (1 / (float)p.framerate) * 1e9;
-            }
+            frame_period = p.framerate > 0 ? 1e9 / p.framerate : 1e9;
+            clock_gettime(CLOCK_MONOTONIC, &frame_deadline);
 
             while (!resizeTerminal) {
 
@@ -955,17 +1508,77 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 refresh();
 #endif
 
+                // input [offline]: wait for the audio of the next frame, at the end of the file
+                // or of a replayed recording quit like 'q' does
+                if (audio.offline ? !offline_next_frame(&audio) : input_ended(&audio)) {
+                    should_quit = 1;
+                    reloadConf = true;
+                    resizeTerminal = true;
+                    continue;
+                }
+
+                // input: the audio thread switched to another sample rate and waits for the FFT
+                // bands and the bar tables to follow
+                unsigned int input_rate = __atomic_load_n(&audio.input_rate, __ATOMIC_ACQUIRE);
+                if (input_rate != audio.rate) {
+                    change_rate(&audio, &p, input_rate, have_wisdom_path ? wisdomPath : NULL);
+                    if (p.upper_cut_off > audio.rate / 2)
+                        p.upper_cut_off = audio.rate / 2;
+                    resizeTerminal = true;
+                    continue;
+                }
+
+                // process: take the latest audio from the input ring, or only the latest bars the
+                // goertzel filters computed from it on the audio thread
+                struct channel_frame frame = {
+                    .number_of_bars = p.stereo ? number_of_bars / 2 : number_of_bars,
+                    .band_count = p.fft_bands,
+                    .analysis = analysis,
+                    .bins = bar_bins,
+                    .used_first = used_first,
+                    .used_last = used_last,
+                    .eq = eq,
+                    .sens = p.sens,
+                    .ignore = p.ignore,
+                    .monstercat = p.monstercat,
+                    .waves = p.waves,
+                    .temp = {temp_l, temp_r},
+                    .bars = {bars_left, bars_right},
+                };
+                unsigned int new_frames =
+                    analysis == ANALYSIS_GOERTZEL
+                        ? read_goertzel_bars(&audio, goertzel_bank, frame.temp)
+                        : read_fftw_input_buffers(&audio);
+
+                // with audio_sync only render when there is something new to analyse, the
+                // previous frame is still on screen
+                if (p.audio_sync && new_frames == 0 && audio.terminate != 1) {
+                    wait_for_input(&audio, frame_period);
+                    continue;
+                }
+
                 // process: check if input is present
                 silence = true;
 
-                for (n = 0; n < audio.FFTbassbufferSize; n++) {
-                    if (audio.in_bass_l[n] || audio.in_bass_r[n]) {
-                        silence = false;
-                        break;
+                if (analysis == ANALYSIS_GOERTZEL) {
+                    for (int c = 0; c < audio.fft_channels && silence; c++) {
+                        for (n = 0; n < frame.number_of_bars; n++) {
+                            if (frame.temp[c][n]) {
+                                silence = false;
+                                break;
+                            }
+                        }
+                    }
+                } else {
+                    for (n = 0; n < audio.fft_bands[0].size * audio.fft_channels; n++) {
+                        if (audio.fft_bands[0].in[n]) {
+                            silence = false;
+                            break;
+                        }
                     }
                 }
 
-                if (p.sleep_timer) {
+                if (p.sleep_timer && !audio.offline) {
                     if (silence && sleep_counter <= p.framerate * p.sleep_timer)
                         sleep_counter++;
                     else if (!silence)
@@ -981,84 +1594,18 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                 }
 
                 // process: execute FFT and sort frequency bands
-                pthread_mutex_lock(&lock);
-                fftw_execute(p_bass_l);
-                fftw_execute(p_mid_l);
-                fftw_execute(p_treble_l);
-                if (p.stereo) {
-                    fftw_execute(p_bass_r);
-                    fftw_execute(p_mid_r);
-                    fftw_execute(p_treble_r);
-                    number_of_bars /= 2;
-                }
-                pthread_mutex_unlock(&lock);
-
-                // process: separate frequency bands
-                for (n = 0; n < number_of_bars; n++) {
-
-                    temp_l[n] = 0;
-                    if (p.stereo)
-                        temp_r[n] = 0;
-
-                    // process: add upp FFT values within bands
-                    for (int i = FFTbuffer_lower_cut_off[n]; i <= FFTbuffer_upper_cut_off[n]; i++) {
-                        if (n <= bass_cut_off_bar) {
-
-                            temp_l[n] += hypot(out_bass_l[i][0], out_bass_l[i][1]);
-
-                            if (p.stereo)
-                                temp_r[n] += hypot(out_bass_r[i][0], out_bass_r[i][1]);
-
-                        } else if (n > bass_cut_off_bar && n <= treble_cut_off_bar) {
-
-                            temp_l[n] += hypot(out_mid_l[i][0], out_mid_l[i][1]);
-
-                            if (p.stereo)
-                                temp_r[n] += hypot(out_mid_r[i][0], out_mid_r[i][1]);
-
-                        } else if (n > treble_cut_off_bar) {
-
-                            temp_l[n] += hypot(out_treble_l[i][0], out_treble_l[i][1]);
-
-                            if (p.stereo)
-                                temp_r[n] += hypot(out_treble_r[i][0], out_treble_r[i][1]);
-                        }
-                    }
-
-                    // getting average multiply with sens and eq
-                    temp_l[n] /= FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1;
-                    temp_l[n] *= p.sens * eq[n];
-
-                    if (temp_l[n] <= p.ignore)
-                        temp_l[n] = 0;
-
-                    bars_left[n] = temp_l[n];
-
-                    if (p.stereo) {
-                        temp_r[n] /= FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1;
-                        temp_r[n] *= p.sens * eq[n];
-
-                        if (temp_r[n] <= p.ignore)
-                            temp_r[n] = 0;
-
-                        bars_right[n] = temp_r[n];
-                    }
-                }
-                if (p.stereo)
-                    number_of_bars *= 2;
-                // process [filter]
-
-                if (p.monstercat) {
-                    if (p.stereo) {
-                        bars_left =
-                            monstercat_filter(bars_left, number_of_bars / 2, p.waves, p.monstercat);
-                        bars_right = monstercat_filter(bars_right, number_of_bars / 2, p.waves,
-                                                       p.monstercat);
-                    } else {
-                        bars_left =
-                            monstercat_filter(bars_left, number_of_bars, p.waves, p.monstercat);
-                    }
+                for (int b = 0; b < p.fft_bands; b++) {
+                    if (fft_frames[b] < fft_hop[b])
+                        fft_frames[b] += new_frames;
+                    frame.band_due[b] =
+                        analysis != ANALYSIS_GOERTZEL && fft_frames[b] >= fft_hop[b];
+                    if (frame.band_due[b])
+                        fft_frames[b] = 0;
                 }
+                // input [offline]: all of this frame's audio is read, the input can go on
+                if (audio.offline)
+                    offline_frame_taken(&audio);
+                process_frame(&frame, audio.fft_channels);
 
                 // processing signal
 
@@ -1196,48 +1743,24 @@ as of 0.4.0 all options are specified in config file, see in '/home/username/.co
                     exit(EXIT_FAILURE);
                 }
 
-                nanosleep(&req, NULL);
+                // offline the next frame is due as soon as its audio is there
+                if (!audio.offline) {
+                    wait_for_next_frame(&frame_deadline, frame_period);
+                    if (p.audio_sync)
+                        wait_for_input(&audio, frame_period);
+                }
             } // resize terminal
 
         } // reloading config
-        req.tv_sec = 0;
-        req.tv_nsec = 100; // waiting some time to make sure audio is ready
-        nanosleep(&req, NULL);
-
-        //**telling audio thread to terminate**//
-        audio.terminate = 1;
-        pthread_join(p_thread, NULL);
-
-        if (p.userEQ_enabled)
-            free(p.userEQ);
-
-        free(audio.source);
-
-        fftw_free(audio.in_bass_r);
-        fftw_free(audio.in_bass_l);
-        fftw_free(out_bass_r);
-        fftw_free(out_bass_l);
-        fftw_destroy_plan(p_bass_l);
-        fftw_destroy_plan(p_bass_r);
-
-        fftw_free(audio.in_mid_r);
-        fftw_free(audio.in_mid_l);
-        fftw_free(out_mid_r);
-        fftw_free(out_mid_l);
-        fftw_destroy_plan(p_mid_l);
-        fftw_destroy_plan(p_mid_r);
-
-        fftw_free(audio.in_treble_r);
-        fftw_free(audio.in_treble_l);
-        fftw_free(out_treble_r);
-        fftw_free(out_treble_l);
-        fftw_destroy_plan(p_treble_l);
-        fftw_destroy_plan(p_treble_r);
-
         cleanup();
 
-        if (should_quit)
+        if (should_quit) {
+            stop_input(&audio, p_thread);
+            if (audio.recorder)
+                stop_recording(audio.recorder);
+            free_dsp(&audio);
             return EXIT_SUCCESS;
+        }
 
         // fclose(fp);
     }
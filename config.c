@@ -23,15 +23,20 @@ enum input_method default_methods[] = {
     INPUT_PULSE,
 };
 
-char *outputMethod, *channels, *xaxisScale;
+char *outputMethod, *channels, *xaxisScale, *fftPlanner, *fftSizes, *fftCrossovers, *fftOverlaps,
+    *analysis, *fifoFormat;
+
+const char *fifo_format_names[] = {
+    "s16le", "s16be", "s24le", "s24be", "s32le", "s32be", "f32le", "f32be",
+};
 
 const char *input_method_names[] = {
-    "fifo", "portaudio", "alsa", "pulse", "sndio", "shmem",
+    "fifo", "portaudio", "alsa", "pulse", "sndio", "shmem", "jack", "synthetic", "file", "replay",
 };
 
 const bool has_input_method[] = {
-    true, /** Always have at least FIFO and shmem input. */
-    HAS_PORTAUDIO, HAS_ALSA, HAS_PULSE, HAS_SNDIO, true,
+    true, /** Always have at least FIFO, shmem, synthetic, file and replay input. */
+    HAS_PORTAUDIO, HAS_ALSA, HAS_PULSE, HAS_SNDIO, true, HAS_JACK, true, true, true,
 };
 
 enum input_method input_method_by_name(const char *str) {
@@ -233,6 +238,85 @@ bool validate_artnet(struct config_params *p, struct error_s *error) {
 }
 #endif
 
+// parses a comma separated list of integers, returns how many were read or -1 if the list is not
+// made of integers or has more than max of them
+static int parse_int_list(const char *list, int *values, int max) {
+    int count = 0;
+    const char *c = list;
+
+    while (*c == ' ')
+        c++;
+    if (*c == '\0')
+        return 0;
+
+    while (true) {
+        char *end;
+        long value = strtol(c, &end, 10);
+        if (end == c || count == max)
+            return -1;
+        values[count++] = value;
+
+        c = end;
+        while (*c == ' ')
+            c++;
+        if (*c == '\0')
+            return count;
+        if (*c != ',')
+            return -1;
+        c++;
+    }
+}
+
+// validate: FFT resolution bands
+static bool validate_fft_bands(struct config_params *p, struct error_s *error) {
+    p->fft_bands = parse_int_list(fftSizes, p->fft_size, MAX_FFT_BANDS);
+    if (p->fft_bands < 1) {
+        write_errorf(error, "fft_sizes must be a list of 1 to %d FFT sizes, got '%s'\n",
+                     MAX_FFT_BANDS, fftSizes);
+        return false;
+    }
+    for (int b = 0; b < p->fft_bands; b++) {
+        if (p->fft_size[b] < 16 || p->fft_size[b] > 65536 || p->fft_size[b] % 2 != 0) {
+            write_errorf(error, "fft size %d must be an even number from 16 to 65536\n",
+                         p->fft_size[b]);
+            return false;
+        }
+        if (b > 0 && p->fft_size[b] > p->fft_size[b - 1]) {
+            write_errorf(error, "fft_sizes go from the lowest frequencies up and can't grow\n");
+            return false;
+        }
+    }
+
+    int crossovers = parse_int_list(fftCrossovers, p->fft_crossover, MAX_FFT_BANDS - 1);
+    if (crossovers != p->fft_bands - 1) {
+        write_errorf(error, "fft_crossovers needs one frequency less than fft_sizes, got '%s'\n",
+                     fftCrossovers);
+        return false;
+    }
+    for (int b = 0; b < crossovers; b++) {
+        if (p->fft_crossover[b] <= (b > 0 ? p->fft_crossover[b - 1] : 0)) {
+            write_errorf(error, "fft_crossovers must be positive and increasing\n");
+            return false;
+        }
+    }
+
+    int overlaps = parse_int_list(fftOverlaps, p->fft_overlap, MAX_FFT_BANDS);
+    if (overlaps == 0) {
+        for (int b = 0; b < p->fft_bands; b++)
+            p->fft_overlap[b] = 100;
+    } else if (overlaps != p->fft_bands) {
+        write_errorf(error, "fft_overlaps needs one value per fft size, got '%s'\n", fftOverlaps);
+        return false;
+    }
+    for (int b = 0; b < p->fft_bands; b++) {
+        if (p->fft_overlap[b] < 0 || p->fft_overlap[b] > 100) {
+            write_errorf(error, "fft overlap must be from 0 to 100%%\n");
+            return false;
+        }
+    }
+    return true;
+}
+
 bool validate_config(struct config_params *p, struct error_s *error) {
     // validate: output method
     p->om = OUTPUT_NOT_SUPORTED;
@@ -318,6 +402,94 @@ bool validate_config(struct config_params *p, struct error_s *error) {
         p->xaxis = NOTE;
     }
 
+    // validate: fft planner
+    if (strcmp(fftPlanner, "estimate") == 0) {
+        p->planner = PLANNER_ESTIMATE;
+    } else if (strcmp(fftPlanner, "measure") == 0) {
+        p->planner = PLANNER_MEASURE;
+    } else if (strcmp(fftPlanner, "patient") == 0) {
+        p->planner = PLANNER_PATIENT;
+    } else {
+        write_errorf(error,
+                     "fft planner %s is not supported, supported planners are: 'estimate', "
+                     "'measure' and 'patient'\n",
+                     fftPlanner);
+        return false;
+    }
+
+    // validate: analysis
+    if (strcmp(analysis, "fft") == 0) {
+        p->analysis = ANALYSIS_FFT;
+    } else if (strcmp(analysis, "goertzel") == 0) {
+        p->analysis = ANALYSIS_GOERTZEL;
+    } else {
+        write_errorf(error, "analysis %s is not supported, supported are: 'fft' and 'goertzel'\n",
+                     analysis);
+        return false;
+    }
+    if (p->goertzel_bars < 0)
+        p->goertzel_bars = 0;
+
+    if (!validate_fft_bands(p, error))
+        return false;
+
+    // validate: fifo sample format, without one sample_bits picks a little endian integer format.
+    // Raw pcm files are read the same way
+    if (p->im == INPUT_FIFO || p->im == INPUT_FILE) {
+        if (fifoFormat[0] == '\0') {
+            p->fifo_format = p->fifoSampleBits == 24   ? FIFO_S24LE
+                             : p->fifoSampleBits == 32 ? FIFO_S32LE
+                                                       : FIFO_S16LE;
+        } else {
+            p->fifo_format = 0;
+            while (p->fifo_format < FIFO_FORMAT_MAX &&
+                   strcmp(fifoFormat, fifo_format_names[p->fifo_format]) != 0)
+                p->fifo_format++;
+            if (p->fifo_format == FIFO_FORMAT_MAX) {
+                write_errorf(error,
+                             "sample format %s is not supported, supported formats are: 's16le', "
+                             "'s16be', 's24le', 's24be', 's32le', 's32be', 'f32le' and 'f32be'\n",
+                             fifoFormat);
+                return false;
+            }
+            p->fifoSampleBits = p->fifo_format < FIFO_S24LE   ? 16
+                                : p->fifo_format < FIFO_S32LE ? 24
+                                                              : 32;
+        }
+    }
+
+    if (p->input_latency < 0) {
+        write_errorf(error, "input latency can't be negative\n");
+        return false;
+    }
+    if (p->im == INPUT_FILE && p->audio_source[0] == '\0') {
+        write_errorf(error,
+                     "input method 'file' needs the wav or raw pcm file to render as source\n");
+        return false;
+    }
+    if (p->im == INPUT_REPLAY && (p->audio_source[0] == '\0' || p->speed < 0)) {
+        write_errorf(error, "input method 'replay' needs the recording to replay as source and a "
+                            "speed of 0 or more\n");
+        return false;
+    }
+    if (p->im == INPUT_SYNTHETIC) {
+        if (p->fifoSample < 1000 || p->block_size < 1 || p->block_size > 65536 || p->speed < 0) {
+            write_errorf(error, "synthetic input needs a sample_rate of at least 1000, a "
+                                "block_size from 1 to 65536 and a speed of 0 or more\n");
+            return false;
+        }
+    }
+
+    // validate: dsp threads
+    if (p->fft_threads < 1)
+        p->fft_threads = 1;
+#ifndef FFTW_THREADS
+    if (p->fft_threads > 1) {
+        write_errorf(error, "fft_threads needs cava built with the fftw threads library\n");
+        return false;
+    }
+#endif
+
     // validate: output channels
     p->stereo = -1;
     if (strcmp(channels, "mono") == 0) {
@@ -556,6 +728,16 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     p->lower_cut_off = iniparser_getint(ini, "general:lower_cutoff_freq", 50);
     p->upper_cut_off = iniparser_getint(ini, "general:higher_cutoff_freq", 10000);
     p->sleep_timer = iniparser_getint(ini, "general:sleep_timer", 0);
+    p->audio_sync = iniparser_getint(ini, "general:audio_sync", 0);
+    fftPlanner = (char *)iniparser_getstring(ini, "general:fft_planner", "measure");
+    analysis = (char *)iniparser_getstring(ini, "general:analysis", "fft");
+    p->channel_threads = iniparser_getint(ini, "general:channel_threads", 0);
+    p->fft_threads = iniparser_getint(ini, "general:fft_threads", 1);
+    fftSizes = (char *)iniparser_getstring(ini, "general:fft_sizes", "4096, 2048, 1024");
+    fftCrossovers = (char *)iniparser_getstring(ini, "general:fft_crossovers", "150, 2500");
+    fftOverlaps = (char *)iniparser_getstring(ini, "general:fft_overlaps", "");
+    p->fft_decimation = iniparser_getint(ini, "general:fft_decimation", 1);
+    p->goertzel_bars = iniparser_getint(ini, "general:goertzel_bars", 4);
 
     // config: output
     free(channels);
@@ -613,15 +795,18 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
         p->audio_source = strdup(iniparser_getstring(ini, "input:source", "/tmp/mpd.fifo"));
         p->fifoSample = iniparser_getint(ini, "input:sample_rate", 44100);
         p->fifoSampleBits = iniparser_getint(ini, "input:sample_bits", 16);
+        fifoFormat = (char *)iniparser_getstring(ini, "input:sample_format", "");
         break;
 #ifdef PULSE
     case INPUT_PULSE:
         p->audio_source = strdup(iniparser_getstring(ini, "input:source", "auto"));
+        p->input_latency = iniparser_getint(ini, "input:latency", 0);
         break;
 #endif
 #ifdef SNDIO
     case INPUT_SNDIO:
         p->audio_source = strdup(iniparser_getstring(ini, "input:source", SIO_DEVANY));
+        p->input_latency = iniparser_getint(ini, "input:latency", 0);
         break;
 #endif
     case INPUT_SHMEM:
@@ -633,6 +818,27 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
         p->audio_source = strdup(iniparser_getstring(ini, "input:source", "auto"));
         break;
 #endif
+#ifdef JACK
+    case INPUT_JACK:
+        p->audio_source = strdup(iniparser_getstring(ini, "input:source", "auto"));
+        break;
+#endif
+    case INPUT_SYNTHETIC:
+        p->audio_source = strdup(iniparser_getstring(ini, "input:source", "sweep"));
+        p->fifoSample = iniparser_getint(ini, "input:sample_rate", 44100);
+        p->block_size = iniparser_getint(ini, "input:block_size", 512);
+        p->speed = iniparser_getdouble(ini, "input:speed", 1);
+        break;
+    case INPUT_FILE:
+        p->audio_source = strdup(iniparser_getstring(ini, "input:source", ""));
+        p->fifoSample = iniparser_getint(ini, "input:sample_rate", 44100);
+        p->fifoSampleBits = iniparser_getint(ini, "input:sample_bits", 16);
+        fifoFormat = (char *)iniparser_getstring(ini, "input:sample_format", "");
+        break;
+    case INPUT_REPLAY:
+        p->audio_source = strdup(iniparser_getstring(ini, "input:source", ""));
+        p->speed = iniparser_getdouble(ini, "input:speed", 1);
+        break;
     case INPUT_MAX: {
         char supported_methods[255] = "";
         for (int i = 0; i < INPUT_MAX; i++) {
@@ -652,6 +858,10 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
         return false;
     }
 
+    // input: whatever the method, what it delivers can be recorded for 'replay'
+    free(p->input_record);
+    p->input_record = strdup(iniparser_getstring(ini, "input:record", ""));
+
 #ifdef ARTNET
     if (strcmp(outputMethod, "artnet") == 0) {
         printf("Configurig Artnet\n");
@@ -766,6 +976,76 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     return result;
 }
 
+static bool string_changed(const char *old, const char *new) {
+    if (old == NULL || new == NULL)
+        return old != new;
+    return strcmp(old, new) != 0;
+}
+
+// classifies the differences between two loaded configs. Rendering is always redone on reload,
+// the FFT plans and the audio thread only when a key they depend on has changed
+int config_changes(const struct config_params *old, const struct config_params *new) {
+    int changes = CONFIG_CHANGED_RENDER;
+
+    // stereo also changes how many channels the FFT plans transform, and the FFT input is only
+    // Hann windowed for analysis = fft
+    if (old->planner != new->planner || old->stereo != new->stereo ||
+        old->analysis != new->analysis || old->channel_threads != new->channel_threads ||
+        old->fft_threads != new->fft_threads)
+        changes |= CONFIG_CHANGED_DSP;
+
+    // the input rings are sized for the largest FFTs, the crossovers decide how far each band is
+    // decimated
+    if (old->fft_bands != new->fft_bands ||
+        memcmp(old->fft_size, new->fft_size, sizeof(int) * new->fft_bands) != 0 ||
+        old->fft_decimation != new->fft_decimation ||
+        (new->fft_decimation &&
+         memcmp(old->fft_crossover, new->fft_crossover, sizeof(int) * (new->fft_bands - 1)) != 0))
+        changes |= CONFIG_CHANGED_DSP | CONFIG_CHANGED_INPUT;
+
+    if (old->im != new->im || string_changed(old->audio_source, new->audio_source) ||
+        old->stereo != new->stereo || string_changed(old->mono_option, new->mono_option) ||
+        string_changed(old->input_record, new->input_record))
+        changes |= CONFIG_CHANGED_INPUT;
+    if ((new->im == INPUT_FIFO || new->im == INPUT_FILE) &&
+        (old->fifoSample != new->fifoSample || old->fifoSampleBits != new->fifoSampleBits ||
+         old->fifo_format != new->fifo_format))
+        changes |= CONFIG_CHANGED_INPUT;
+    // offline the input cuts the file into frames
+    if ((new->im == INPUT_FILE || new->im == INPUT_REPLAY || new->im == INPUT_SYNTHETIC) &&
+        old->framerate != new->framerate)
+        changes |= CONFIG_CHANGED_INPUT;
+    if (new->im == INPUT_REPLAY && old->speed != new->speed)
+        changes |= CONFIG_CHANGED_INPUT;
+    if (new->im == INPUT_SYNTHETIC &&
+        (old->fifoSample != new->fifoSample || old->block_size != new->block_size ||
+         old->speed != new->speed))
+        changes |= CONFIG_CHANGED_INPUT;
+    if ((new->im == INPUT_PULSE || new->im == INPUT_SNDIO) &&
+        old->input_latency != new->input_latency)
+        changes |= CONFIG_CHANGED_INPUT;
+
+    return changes;
+}
+
+// frees what load_config allocated, artnet settings are released by cfg_artnet_free
+void free_config(struct config_params *p) {
+    free(p->color);
+    free(p->bcolor);
+    free(p->raw_target);
+    free(p->audio_source);
+    free(p->input_record);
+    free(p->data_format);
+    free(p->mono_option);
+    if (p->gradient_colors != NULL) {
+        for (int i = 0; i < p->gradient_count; i++)
+            free(p->gradient_colors[i]);
+        free(p->gradient_colors);
+    }
+    if (p->userEQ_enabled)
+        free(p->userEQ);
+}
+
 #ifdef ARTNET
 void cfg_artnet_alloc (struct config_params* cfg, int no_universes, int no_devices, int no_mappings) {
   cfg->no_universes = no_universes;
@@ -7,6 +7,9 @@
 
 #define MAX_ERROR_LEN 1024
 
+// most resolution bands the FFT engine can split the spectrum into
+#define MAX_FFT_BANDS 8
+
 #ifdef PORTAUDIO
 #define HAS_PORTAUDIO true
 #else
@@ -31,6 +34,12 @@
 #define HAS_SNDIO false
 #endif
 
+#ifdef JACK
+#define HAS_JACK true
+#else
+#define HAS_JACK false
+#endif
+
 // These are in order of least-favourable to most-favourable choices, in case
 // multiple are supported and configured.
 enum input_method {
@@ -40,6 +49,10 @@ enum input_method {
     INPUT_PULSE,
     INPUT_SNDIO,
     INPUT_SHMEM,
+    INPUT_JACK,
+    INPUT_SYNTHETIC,
+    INPUT_FILE,
+    INPUT_REPLAY,
     INPUT_MAX
 };
 
@@ -47,6 +60,25 @@ enum output_method { OUTPUT_NCURSES, OUTPUT_NONCURSES, OUTPUT_RAW, OUTPUT_ARTNET
 
 enum xaxis_scale { NONE, FREQUENCY, NOTE };
 
+enum fft_planner { PLANNER_ESTIMATE, PLANNER_MEASURE, PLANNER_PATIENT };
+
+// how the samples in a fifo are stored, 24 bit ones are packed into 3 bytes
+enum fifo_format {
+    FIFO_S16LE,
+    FIFO_S16BE,
+    FIFO_S24LE,
+    FIFO_S24BE,
+    FIFO_S32LE,
+    FIFO_S32BE,
+    FIFO_F32LE,
+    FIFO_F32BE,
+    FIFO_FORMAT_MAX
+};
+
+// how bars are measured: averaging the FFT bins in their range or with a Goertzel filter per bar
+// run on the audio thread
+enum analysis { ANALYSIS_FFT, ANALYSIS_GOERTZEL };
+
 #ifdef ARTNET
 struct device {
   int universe;
@@ -78,18 +110,26 @@ typedef struct {
 
 
 struct config_params {
-    char *color, *bcolor, *raw_target, *audio_source,
+    char *color, *bcolor, *raw_target, *audio_source, *input_record,
         /**gradient_color_1, *gradient_color_2,*/ **gradient_colors, *data_format, *mono_option;
     char bar_delim, frame_delim;
-    double monstercat, integral, gravity, ignore, sens;
+    double monstercat, integral, gravity, ignore, sens, speed;
     unsigned int lower_cut_off, upper_cut_off;
     double *userEQ;
     enum input_method im;
     enum output_method om;
     enum xaxis_scale xaxis;
+    enum fft_planner planner;
+    enum analysis analysis;
+    enum fifo_format fifo_format;
     int userEQ_keys, userEQ_enabled, col, bgcol, autobars, stereo, is_bin, ascii_range, bit_format,
         gradient, gradient_count, fixedbars, framerate, bar_width, bar_spacing, autosens, overshoot,
-        waves, fifoSample, fifoSampleBits, sleep_timer;
+        waves, fifoSample, fifoSampleBits, sleep_timer, audio_sync, channel_threads, fft_threads,
+        fft_decimation, goertzel_bars, input_latency, block_size;
+    // resolution bands from the lowest frequencies up: FFT size, overlap between consecutive
+    // transforms in % and the frequency where the next band takes over
+    int fft_bands;
+    int fft_size[MAX_FFT_BANDS], fft_overlap[MAX_FFT_BANDS], fft_crossover[MAX_FFT_BANDS - 1];
     
 #ifdef ARTNET   
     int no_universes;
@@ -102,6 +142,13 @@ struct config_params {
 #endif
 };
 
+// what has to be rebuilt after a config reload, see config_changes()
+enum config_change {
+    CONFIG_CHANGED_RENDER = 1, // output, colors, bars and smoothing
+    CONFIG_CHANGED_DSP = 2,    // FFT buffers and plans
+    CONFIG_CHANGED_INPUT = 4,  // audio thread
+};
+
 struct error_s {
     char message[MAX_ERROR_LEN];
     int length;
@@ -109,6 +156,8 @@ struct error_s {
 
 bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colorsOnly,
                  struct error_s *error);
+int config_changes(const struct config_params *old, const struct config_params *new);
+void free_config(struct config_params *p);
                  
 #ifdef ARTNET
 void cfg_artnet_alloc (struct config_params* cfg, int no_universes, int no_devices, int no_mappings);
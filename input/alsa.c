@@ -5,16 +5,33 @@
 
 #include <alloca.h>
 #include <alsa/asoundlib.h>
-#include <math.h>
+#include <poll.h>
 
 // assuming stereo
 #define CHANNELS_COUNT 2
 #define SAMPLE_RATE 44100
 
+// capture formats we take as they come, widest first so nothing of a 24 or 32 bit device is lost
+// before the FFT. S16_LE is the last resort and what cava used to ask for
+static const struct {
+    snd_pcm_format_t alsa;
+    enum sample_format format;
+    int bits;
+} alsa_formats[] = {
+    {SND_PCM_FORMAT_S32_LE, SAMPLE_S32, 32}, {SND_PCM_FORMAT_FLOAT_LE, SAMPLE_FLOAT, 32},
+    {SND_PCM_FORMAT_S24_LE, SAMPLE_S24, 24}, {SND_PCM_FORMAT_S24_3LE, SAMPLE_S24_3LE, 24},
+    {SND_PCM_FORMAT_S16_LE, SAMPLE_S16, 16},
+};
+#define ALSA_FORMAT_COUNT (int)(sizeof(alsa_formats) / sizeof(alsa_formats[0]))
+
+// how long the mmap capture waits for a period before it looks at audio->terminate again, in ms
+#define ALSA_POLL_TIMEOUT 100
+
 static void initialize_audio_parameters(snd_pcm_t **handle, struct audio_data *audio,
-                                        snd_pcm_uframes_t *frames) {
-    // alsa: open device to capture audio
-    int err = snd_pcm_open(handle, audio->source, SND_PCM_STREAM_CAPTURE, 0);
+                                        snd_pcm_uframes_t *frames, enum sample_format *format,
+                                        bool *mmap) {
+    // alsa: open device to capture audio, non blocking for the mmap capture that polls
+    int err = snd_pcm_open(handle, audio->source, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
     if (err < 0) {
         fprintf(stderr, "error opening stream: %s\n", snd_strerror(err));
         exit(EXIT_FAILURE);
@@ -24,10 +41,22 @@ static void initialize_audio_parameters(snd_pcm_t **handle, struct audio_data *a
     snd_pcm_hw_params_t *params;
     snd_pcm_hw_params_alloca(&params);      // assembling params
     snd_pcm_hw_params_any(*handle, params); // setting defaults or something
-    // interleaved mode right left right left
-    snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    // trying to set 16bit
-    snd_pcm_hw_params_set_format(*handle, params, SND_PCM_FORMAT_S16_LE);
+    // interleaved mode right left right left, straight from the DMA area where the device lets us
+    *mmap = snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+    if (!*mmap) {
+        snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+        snd_pcm_nonblock(*handle, 0);
+    }
+    // the widest format the device captures
+    int f = 0;
+    while (f < ALSA_FORMAT_COUNT - 1 &&
+           snd_pcm_hw_params_test_format(*handle, params, alsa_formats[f].alsa) < 0)
+        f++;
+    err = snd_pcm_hw_params_set_format(*handle, params, alsa_formats[f].alsa);
+    if (err < 0) {
+        fprintf(stderr, "no supported sample format: %s\n", snd_strerror(err));
+        exit(EXIT_FAILURE);
+    }
     snd_pcm_hw_params_set_channels(*handle, params, CHANNELS_COUNT);
     unsigned int sample_rate = SAMPLE_RATE;
     // trying our rate
@@ -45,58 +74,94 @@ static void initialize_audio_parameters(snd_pcm_t **handle, struct audio_data *a
         exit(EXIT_FAILURE);
     }
 
-    // getting actual format
-    snd_pcm_hw_params_get_format(params, (snd_pcm_format_t *)&sample_rate);
-    // converting result to number of bits
-    if (sample_rate <= 5)
-        audio->format = 16;
-    else if (sample_rate <= 9)
-        audio->format = 24;
-    else
-        audio->format = 32;
-    snd_pcm_hw_params_get_rate(params, &audio->rate, NULL);
+    audio->format = alsa_formats[f].bits;
+    *format = alsa_formats[f].format;
+    snd_pcm_hw_params_get_rate(params, &sample_rate, NULL);
     snd_pcm_hw_params_get_period_size(params, frames, NULL);
     // snd_pcm_hw_params_get_period_time(params, &sample_rate, &dir);
+
+    // the device may not do 44.1kHz, have the FFT sizes follow what it gave us
+    set_input_rate(audio, sample_rate);
 }
 
-static int get_certain_frame(signed char *buffer, int buffer_index, int adjustment) {
-    // using the 10 upper bits this would give me a vert res of 1024, enough...
-    int temp = buffer[buffer_index + adjustment - 1] << 2;
-    int lo = buffer[buffer_index + adjustment - 2] >> 6;
-    if (lo < 0)
-        lo = abs(lo) + 1;
-    if (temp >= 0)
-        temp += lo;
-    else
-        temp -= lo;
-    return temp;
+// alsa [mmap]: get capture going again after an overrun or a suspend. Nothing here waits, a resume
+// that is still in progress stays -ESTRPIPE and is tried again on the next wakeup
+static int recover(snd_pcm_t *handle, int err) {
+    if (err == -ESTRPIPE) {
+        err = snd_pcm_resume(handle);
+        if (err == -EAGAIN)
+            return -ESTRPIPE;
+        if (err == 0)
+            return 0;
+    } else if (err == -EPIPE) {
+        debug("overrun occurred\n");
+    }
+    err = snd_pcm_prepare(handle);
+    if (err == 0)
+        err = snd_pcm_start(handle);
+    if (err < 0)
+        debug("could not recover capture: %s\n", snd_strerror(err));
+    return err;
 }
-/*
-static void fill_audio_outs(struct audio_data* audio, signed char* buffer,
-const int size) {
-        int radj = audio->format / 4; // adjustments for interleaved
-        int ladj = audio->format / 8;
-        static int audio_out_buffer_index = 0;
-        // sorting out one channel and only biggest octet
-        for (int buffer_index = 0; buffer_index < size; buffer_index += ladj * 2) {
-                // first channel
-                int tempr = get_certain_frame(buffer, buffer_index, radj);
-                // second channel
-                int templ = get_certain_frame(buffer, buffer_index, ladj);
-
-                // mono: adding channels and storing it in the buffer
-                if (audio->channels == 1)
-                        audio->audio_out_l[audio_out_buffer_index] = (templ + tempr) / 2;
-                else { // stereo storing channels in buffer
-                        audio->audio_out_l[audio_out_buffer_index] = templ;
-                        audio->audio_out_r[audio_out_buffer_index] = tempr;
-                }
-
-                ++audio_out_buffer_index;
-                audio_out_buffer_index %= audio->FFTbufferSize;
+
+// alsa [mmap]: hand every period to the input rings as soon as poll() says it is there, converting
+// it straight out of the DMA area instead of copying it out with snd_pcm_readi first
+static void capture_mmap(snd_pcm_t *handle, struct audio_data *audio, snd_pcm_uframes_t period_size,
+                         enum sample_format format) {
+    int count = snd_pcm_poll_descriptors_count(handle);
+    struct pollfd *fds = (struct pollfd *)malloc(count * sizeof(struct pollfd));
+    snd_pcm_poll_descriptors(handle, fds, count);
+    int frame_bits = CHANNELS_COUNT * 8 * sample_format_bytes(format);
+
+    int err = snd_pcm_start(handle);
+    while (!audio->terminate) {
+        if (err < 0 && (err = recover(handle, err)) < 0) {
+            poll(NULL, 0, ALSA_POLL_TIMEOUT);
+            continue;
+        }
+
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+        if (avail < 0) {
+            err = avail;
+            continue;
         }
+        if ((snd_pcm_uframes_t)avail < period_size) {
+            unsigned short revents = 0;
+            if (poll(fds, count, ALSA_POLL_TIMEOUT) > 0) {
+                snd_pcm_poll_descriptors_revents(handle, fds, count, &revents);
+                if (revents & POLLERR)
+                    err = snd_pcm_state(handle) == SND_PCM_STATE_SUSPENDED ? -ESTRPIPE : -EPIPE;
+            }
+            continue;
+        }
+
+        // the available frames may wrap around the end of the buffer, then it takes two areas
+        while (avail > 0 && err >= 0) {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset, frames = avail;
+            err = snd_pcm_mmap_begin(handle, &areas, &offset, &frames);
+            if (err < 0 || frames == 0)
+                break;
+            // the main loop reports it and quits, nothing is captured from here on
+            if (areas[0].step != (unsigned int)frame_bits) {
+                snprintf(audio->error_message, sizeof(audio->error_message),
+                         __FILE__ ": unexpected mmap layout of %u bits per frame\n", areas[0].step);
+                audio->terminate = 1;
+                break;
+            }
+
+            const char *dma = (const char *)areas[0].addr;
+            write_input_frames(audio, dma + (areas[0].first + offset * areas[0].step) / 8, frames,
+                               format);
+
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle, offset, frames);
+            if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+                err = committed < 0 ? committed : -EPIPE;
+            avail -= frames;
+        }
+    }
+    free(fds);
 }
-*/
 
 void *input_alsa(void *data) {
     int err;
@@ -104,46 +169,25 @@ void *input_alsa(void *data) {
     snd_pcm_t *handle;
     snd_pcm_uframes_t buffer_size;
     snd_pcm_uframes_t period_size;
-    snd_pcm_uframes_t frames = audio->FFTtreblebufferSize;
+    snd_pcm_uframes_t frames = audio->input_buffer_size;
+    enum sample_format format;
+    bool mmap;
 
-    initialize_audio_parameters(&handle, audio, &frames);
+    initialize_audio_parameters(&handle, audio, &frames, &format, &mmap);
     snd_pcm_get_params(handle, &buffer_size, &period_size);
 
-    int radj = audio->format / 4; // adjustments for interleaved
-    int ladj = audio->format / 8;
-    int16_t buf[period_size];
-    int32_t buffer32[period_size];
-    frames = period_size / ((audio->format / 8) * CHANNELS_COUNT);
-    // printf("period size: %lu\n", period_size);
-    // exit(0);
+    if (mmap) {
+        capture_mmap(handle, audio, period_size, format);
+        snd_pcm_close(handle);
+        return NULL;
+    }
 
-    // frames * bits/8 * channels
-    // const int size = frames * (audio->format / 8) * CHANNELS_COUNT;
-    signed char *buffer = malloc(period_size);
+    // one period of interleaved frames in the format the device gave us, converted as a whole
+    frames = period_size;
+    void *buffer = malloc(frames * CHANNELS_COUNT * sample_format_bytes(format));
 
     while (!audio->terminate) {
-        switch (audio->format) {
-        case 16:
-            err = snd_pcm_readi(handle, buf, frames);
-            break;
-        case 32:
-            err = snd_pcm_readi(handle, buffer32, frames);
-            for (uint16_t i = 0; i < frames * 2; i++) {
-                buf[i] = buffer32[i] / pow(2, 16);
-            }
-            break;
-        default:
-            err = snd_pcm_readi(handle, buffer, frames);
-            // sorting out one channel and only biggest octet
-            for (uint16_t i = 0; i < period_size * 2; i += ladj * 2) {
-                // first channel
-                buf[i] = get_certain_frame(buffer, i, ladj);
-                // second channel
-                buf[i + 1] = get_certain_frame(buffer, i, radj);
-            }
-            // fill_audio_outs(audio, buffer, period_size);
-            break;
-        }
+        err = snd_pcm_readi(handle, buffer, frames);
 
         if (err == -EPIPE) {
             /* EPIPE means overrun */
@@ -155,9 +199,8 @@ void *input_alsa(void *data) {
             debug("short read, read %d %d frames\n", err, (int)frames);
         }
 
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(frames, buf, data);
-        pthread_mutex_unlock(&lock);
+        if (err > 0)
+            write_input_frames(audio, buffer, err, format);
     }
 
     free(buffer);
@@ -1,91 +1,594 @@
 #include "input/common.h"
+#include "input/record.h"
+#include <limits.h>
 #include <math.h>
 
 #include <string.h>
+#include <time.h>
 
-void reset_output_buffers(struct audio_data *data) {
-    memset(data->in_bass_r, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_bass_l, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_mid_r, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_mid_l, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_treble_r, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_treble_l, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_bass_r_raw, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_bass_l_raw, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_mid_r_raw, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_mid_l_raw, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_treble_r_raw, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_treble_l_raw, 0, sizeof(double) * data->FFTtreblebufferSize);
+#ifndef M_PI
+#define M_PI 3.1415926535897932385
+#endif
+
+// wakes the main loop if it is waiting in wait_for_input(). This never blocks the audio thread, if
+// the lock is taken the main loop is about to check write_pos itself or will time out
+static void notify_input(struct audio_data *audio) {
+    if (!__atomic_load_n(&audio->input_waiting, __ATOMIC_SEQ_CST))
+        return;
+    if (pthread_mutex_trylock(&audio->input_lock) == 0) {
+        pthread_cond_signal(&audio->input_cond);
+        pthread_mutex_unlock(&audio->input_lock);
+    }
 }
 
-int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data) {
-    if (frames == 0)
-        return 0;
-    struct audio_data *audio = (struct audio_data *)data;
+// taps of the halfband lowpass on either side of the centre. Every second one is zero, only the odd
+// offsets 1, 3, ... are kept
+#define HALFBAND_PAIRS ((DECIMATOR_TAPS + 1) / 4)
+static dsp_real halfband_taps[HALFBAND_PAIRS];
 
-    for (uint16_t n = audio->FFTbassbufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_bass_l_raw[n - i] = audio->in_bass_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_bass_r_raw[n - i] = audio->in_bass_r_raw[n - i - frames];
-        }
+// input: Blackman windowed sinc with its cut-off at a quarter of the input rate. Flat to 0.2 and
+// 60dB down from 0.3 of the input rate, so the lower 0.39 of the decimated rate stay free of
+// aliases
+static void init_halfband(void) {
+    const int mid = DECIMATOR_TAPS / 2;
+    double sum = 0;
+    for (int i = 0; i < HALFBAND_PAIRS; i++) {
+        int offset = 2 * i + 1, n = mid + offset;
+        double window = 0.42 - 0.5 * cos(2 * M_PI * n / (DECIMATOR_TAPS - 1)) +
+                        0.08 * cos(4 * M_PI * n / (DECIMATOR_TAPS - 1));
+        halfband_taps[i] = sin(M_PI * offset / 2) / (M_PI * offset) * window;
+        sum += 2 * halfband_taps[i];
+    }
+    // unity gain at DC, the centre tap is 0.5
+    for (int i = 0; i < HALFBAND_PAIRS; i++)
+        halfband_taps[i] *= 0.5 / sum;
+}
+
+// one output of the halfband lowpass, x holds the last DECIMATOR_TAPS inputs oldest first
+static dsp_real halfband(const dsp_real *x) {
+    const int mid = DECIMATOR_TAPS / 2;
+    dsp_real y = 0.5 * x[mid];
+    for (int i = 0; i < HALFBAND_PAIRS; i++)
+        y += halfband_taps[i] * (x[mid - 1 - 2 * i] + x[mid + 1 + 2 * i]);
+    return y;
+}
+
+// input: allocate one ring per level the FFT bands read from, holding twice the largest FFT of the
+// level. Levels in between only run the filter and get a token ring
+void init_input_rings(struct audio_data *audio) {
+    unsigned int room = UINT_MAX;
+
+    init_halfband();
+    audio->input_level_count = 1;
+    for (int b = 0; b < audio->fft_band_count; b++)
+        if (audio->fft_bands[b].level >= audio->input_level_count)
+            audio->input_level_count = audio->fft_bands[b].level + 1;
+
+    for (int k = 0; k < audio->input_level_count; k++) {
+        struct input_level *level = &audio->input_levels[k];
+        unsigned int size = 0;
+        for (int b = 0; b < audio->fft_band_count; b++)
+            if (audio->fft_bands[b].level == k && (unsigned int)audio->fft_bands[b].size > size)
+                size = audio->fft_bands[b].size;
+
+        level->ring_size = 16;
+        while (level->ring_size < 2 * size)
+            level->ring_size <<= 1;
+        level->ring_l = (dsp_real *)calloc(level->ring_size, sizeof(dsp_real));
+        level->ring_r = (dsp_real *)calloc(level->ring_size, sizeof(dsp_real));
+        memset(level->hist_l, 0, sizeof(level->hist_l));
+        memset(level->hist_r, 0, sizeof(level->hist_r));
+        level->hist_pos = 0;
+
+        // full rate frames the writer may get ahead of a snapshot of this level, less two samples
+        // for rounding the level positions
+        unsigned int level_room = (level->ring_size - size - 2) << k;
+        if (level_room < room)
+            room = level_room;
     }
-    for (uint16_t n = audio->FFTmidbufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_mid_l_raw[n - i] = audio->in_mid_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_mid_r_raw[n - i] = audio->in_mid_r_raw[n - i - frames];
+    audio->ring_chunk = room / 2;
+    audio->ring_slack = room - audio->ring_chunk;
+    audio->reset_frames = (unsigned int)(audio->fft_bands[0].size + DECIMATOR_TAPS)
+                          << audio->fft_bands[0].level;
+    audio->write_pos = 0;
+    audio->read_pos = 0;
+
+    reset_output_buffers(audio);
+}
+
+void free_input_rings(struct audio_data *audio) {
+    for (int k = 0; k < audio->input_level_count; k++) {
+        free(audio->input_levels[k].ring_l);
+        free(audio->input_levels[k].ring_r);
+    }
+    audio->input_level_count = 0;
+}
+
+// stores the frame with index pos at full rate and feeds it down the levels. Level k gets its next
+// sample whenever the number of full rate frames reaches a multiple of 2^k, so sample i of level k
+// is complete once write_pos >> k > i
+static void push_frame(struct audio_data *audio, dsp_real l, dsp_real r, unsigned int pos) {
+    bool stereo = audio->channels == 2;
+    unsigned int count = pos + 1;
+
+    for (int k = 0; k < audio->input_level_count; k++) {
+        struct input_level *level = &audio->input_levels[k];
+        if (k > 0) {
+            int h = level->hist_pos;
+            level->hist_l[h] = level->hist_l[h + DECIMATOR_TAPS] = l;
+            level->hist_r[h] = level->hist_r[h + DECIMATOR_TAPS] = r;
+            level->hist_pos = h = h + 1 == DECIMATOR_TAPS ? 0 : h + 1;
+            if (count & ((1u << k) - 1))
+                return;
+            l = halfband(level->hist_l + h);
+            if (stereo)
+                r = halfband(level->hist_r + h);
         }
+
+        unsigned int i = ((count >> k) - 1) & (level->ring_size - 1);
+        level->ring_l[i] = l;
+        if (stereo)
+            level->ring_r[i] = r;
     }
-    for (uint16_t n = audio->FFTtreblebufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_treble_l_raw[n - i] = audio->in_treble_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_treble_r_raw[n - i] = audio->in_treble_r_raw[n - i - frames];
+}
+
+// goertzel: start using the bank the main loop handed over, unless it has not collected the one
+// before yet
+static void take_goertzel_bank(struct audio_data *audio) {
+    if (__atomic_load_n(&audio->goertzel_retired, __ATOMIC_ACQUIRE) != NULL)
+        return;
+    struct goertzel_bank *bank = __atomic_exchange_n(&audio->goertzel_next, NULL, __ATOMIC_ACQ_REL);
+    if (bank == NULL)
+        return;
+    __atomic_store_n(&audio->goertzel_retired, audio->goertzel, __ATOMIC_RELEASE);
+    audio->goertzel = bank;
+}
+
+// frames are converted this many at a time on the stack
+#define CONVERT_FRAMES 256
+
+// goertzel: runs the resonators of both sets of a bar over frames first to end, set 1 only once
+// it has started. The six recursions of a channel go through the frames together, their states
+// stay in registers and they overlap instead of waiting on each other
+static void run_resonators(struct goertzel_bar *bar, const dsp_real *frames, int first, int end,
+                           int channels) {
+    const double k0 = bar->coefficient[0], k1 = bar->coefficient[1], k2 = bar->coefficient[2];
+    for (int c = 0; c < channels; c++) {
+        double *s1 = bar->s1[c][0], *s2 = bar->s2[c][0], *t1 = bar->s1[c][1], *t2 = bar->s2[c][1];
+        double a0 = s1[0], a1 = s1[1], a2 = s1[2], b0 = s2[0], b1 = s2[1], b2 = s2[2];
+        double c0 = t1[0], c1 = t1[1], c2 = t1[2], d0 = t2[0], d1 = t2[1], d2 = t2[2];
+        if (bar->count[1] < 0) {
+            for (int f = first; f < end; f++) {
+                double x = frames[2 * f + c];
+                double u0 = x + k0 * a0 - b0, u1 = x + k1 * a1 - b1, u2 = x + k2 * a2 - b2;
+                b0 = a0, b1 = a1, b2 = a2;
+                a0 = u0, a1 = u1, a2 = u2;
+            }
+        } else {
+            for (int f = first; f < end; f++) {
+                double x = frames[2 * f + c];
+                double u0 = x + k0 * a0 - b0, u1 = x + k1 * a1 - b1, u2 = x + k2 * a2 - b2;
+                double v0 = x + k0 * c0 - d0, v1 = x + k1 * c1 - d1, v2 = x + k2 * c2 - d2;
+                b0 = a0, b1 = a1, b2 = a2, d0 = c0, d1 = c1, d2 = c2;
+                a0 = u0, a1 = u1, a2 = u2, c0 = v0, c1 = v1, c2 = v2;
+            }
         }
+        s1[0] = a0, s1[1] = a1, s1[2] = a2, s2[0] = b0, s2[1] = b1, s2[2] = b2;
+        t1[0] = c0, t1[1] = c1, t1[2] = c2, t2[0] = d0, t2[1] = d1, t2[2] = d2;
     }
-    uint16_t n = frames - 1;
-    for (uint16_t i = 0; i < frames; i++) {
-        if (audio->channels == 1) {
-            if (audio->average) {
-                audio->in_bass_l_raw[n] = (buf[i * 2] + buf[i * 2 + 1]) / 2;
+}
+
+// goertzel: feed count interleaved full rate frames to every bar, bar by bar. Both sets of a bar
+// run up to the next end of a block, which publishes the magnitude and starts the set over, so the
+// latest block is what stays published
+static void run_goertzel(struct goertzel_bank *bank, const dsp_real *frames, int count,
+                         int channels) {
+    for (int n = 0; n < bank->bar_count; n++) {
+        struct goertzel_bar *bar = &bank->bars[n];
+        for (int f = 0; f < count;) {
+            // the second set starts half a block late, it counts up to 0 first
+            int take = count - f;
+            for (int set = 0; set < 2; set++) {
+                int left = bar->count[set] < 0 ? -bar->count[set] : bar->length - bar->count[set];
+                if (take > left)
+                    take = left;
+            }
+            run_resonators(bar, frames, f, f + take, channels);
+            bar->count[0] += take;
+            bar->count[1] += take;
+            f += take;
+
+            for (int set = 0; set < 2; set++) {
+                if (bar->count[set] < bar->length)
+                    continue;
+                for (int c = 0; c < channels; c++) {
+                    double re = 0, im = 0, *s1 = bar->s1[c][set], *s2 = bar->s2[c][set];
+                    for (int j = 0; j < GOERTZEL_RESONATORS; j++) {
+                        re += bar->end_s1[j][0] * s1[j] - bar->end_s2[j][0] * s2[j];
+                        im += bar->end_s1[j][1] * s1[j] - bar->end_s2[j][1] * s2[j];
+                        s1[j] = s2[j] = 0;
+                    }
+                    dsp_real magnitude = sqrt(re * re + im * im);
+                    __atomic_store(&bar->out[c], &magnitude, __ATOMIC_RELAXED);
+                }
+                bar->count[set] = 0;
             }
-            if (audio->left) {
-                audio->in_bass_l_raw[n] = buf[i * 2];
+        }
+    }
+}
+
+// pushes silence through the rings until the largest FFT buffer only sees silence, including what
+// is still on its way through the decimation filters. Safe to call from the audio thread
+void reset_output_buffers(struct audio_data *data) {
+    static const dsp_real silence[2 * CONVERT_FRAMES];
+    unsigned int pos = data->write_pos;
+    unsigned int left = data->reset_frames;
+
+    if (data->recorder)
+        record_reset(data->recorder);
+    while (left > 0) {
+        unsigned int n = left < data->ring_chunk ? left : data->ring_chunk;
+        take_goertzel_bank(data);
+        for (unsigned int i = 0; i < n; i++)
+            push_frame(data, 0, 0, pos + i);
+        for (unsigned int i = 0; data->goertzel && i < n; i += CONVERT_FRAMES)
+            run_goertzel(data->goertzel, silence, n - i < CONVERT_FRAMES ? n - i : CONVERT_FRAMES,
+                         data->channels);
+        pos += n;
+        left -= n;
+        __atomic_store_n(&data->write_pos, pos, __ATOMIC_SEQ_CST);
+    }
+    notify_input(data);
+}
+
+// called by the audio thread once it knows the sample rate of its stream, and again whenever that
+// changes. The FFT sizes and the ring depend on the rate, so this waits without touching the ring
+// until the main loop has rebuilt them for it
+void set_input_rate(struct audio_data *audio, unsigned int rate) {
+    struct timespec req = {.tv_sec = 0, .tv_nsec = 1000000};
+
+    if (rate == 0 || rate == __atomic_load_n(&audio->input_rate, __ATOMIC_RELAXED))
+        return;
+    __atomic_store_n(&audio->input_rate, rate, __ATOMIC_SEQ_CST);
+    if (audio->recorder)
+        record_rate(audio->recorder, rate);
+    notify_input(audio);
+    while (__atomic_load_n(&audio->rate, __ATOMIC_ACQUIRE) != rate &&
+           !__atomic_load_n(&audio->terminate, __ATOMIC_RELAXED))
+        nanosleep(&req, NULL);
+}
+
+// input: converters from what the backends deliver to interleaved DSP samples on the scale of 16
+// bit ones. Straight loops without calls, so the compiler can vectorise them
+static void convert_s16(dsp_real *restrict out, const void *restrict in, int n) {
+    const int16_t *s = (const int16_t *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = s[i];
+}
+
+static void convert_s24(dsp_real *restrict out, const void *restrict in, int n) {
+    const int32_t *s = (const int32_t *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = (int32_t)((uint32_t)s[i] << 8) * (dsp_real)(1.0 / 65536);
+}
+
+static void convert_s16_swapped(dsp_real *restrict out, const void *restrict in, int n) {
+    const uint16_t *s = (const uint16_t *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = (int16_t)__builtin_bswap16(s[i]);
+}
+
+static void convert_s24_3le(dsp_real *restrict out, const void *restrict in, int n) {
+    const uint8_t *s = (const uint8_t *)in;
+    for (int i = 0; i < n; i++) {
+        int32_t sample = s[3 * i] | s[3 * i + 1] << 8 | (int8_t)s[3 * i + 2] * 65536;
+        out[i] = sample * (dsp_real)(1.0 / 256);
+    }
+}
+
+static void convert_s24_3be(dsp_real *restrict out, const void *restrict in, int n) {
+    const uint8_t *s = (const uint8_t *)in;
+    for (int i = 0; i < n; i++) {
+        int32_t sample = (int8_t)s[3 * i] * 65536 | s[3 * i + 1] << 8 | s[3 * i + 2];
+        out[i] = sample * (dsp_real)(1.0 / 256);
+    }
+}
+
+static void convert_s32(dsp_real *restrict out, const void *restrict in, int n) {
+    const int32_t *s = (const int32_t *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = s[i] * (dsp_real)(1.0 / 65536);
+}
+
+static void convert_s32_swapped(dsp_real *restrict out, const void *restrict in, int n) {
+    const uint32_t *s = (const uint32_t *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = (int32_t)__builtin_bswap32(s[i]) * (dsp_real)(1.0 / 65536);
+}
+
+static void convert_float(dsp_real *restrict out, const void *restrict in, int n) {
+    const float *s = (const float *)in;
+    for (int i = 0; i < n; i++)
+        out[i] = s[i] * (dsp_real)32768;
+}
+
+static void convert_float_swapped(dsp_real *restrict out, const void *restrict in, int n) {
+    const uint32_t *s = (const uint32_t *)in;
+    for (int i = 0; i < n; i++) {
+        union {
+            uint32_t bits;
+            float value;
+        } sample = {.bits = __builtin_bswap32(s[i])};
+        out[i] = sample.value * (dsp_real)32768;
+    }
+}
+
+static const struct {
+    void (*convert)(dsp_real *restrict out, const void *restrict in, int n);
+    int bytes;
+} sample_formats[] = {
+    [SAMPLE_S16] = {convert_s16, 2},
+    [SAMPLE_S16_SWAPPED] = {convert_s16_swapped, 2},
+    [SAMPLE_S24] = {convert_s24, 4},
+    [SAMPLE_S24_3LE] = {convert_s24_3le, 3},
+    [SAMPLE_S24_3BE] = {convert_s24_3be, 3},
+    [SAMPLE_S32] = {convert_s32, 4},
+    [SAMPLE_S32_SWAPPED] = {convert_s32_swapped, 4},
+    [SAMPLE_FLOAT] = {convert_float, 4},
+    [SAMPLE_FLOAT_SWAPPED] = {convert_float_swapped, 4},
+};
+
+int sample_format_bytes(enum sample_format format) { return sample_formats[format].bytes; }
+
+int write_input_frames(struct audio_data *audio, const void *buf, int frames,
+                       enum sample_format format) {
+    if (frames <= 0)
+        return 0;
+    if (audio->recorder)
+        record_block(audio->recorder, buf, frames, format);
+    const uint8_t *in = (const uint8_t *)buf;
+    const int frame_bytes = 2 * sample_formats[format].bytes;
+    dsp_real samples[2 * CONVERT_FRAMES];
+    unsigned int pos = audio->write_pos; // only this thread ever changes it
+
+    // never write more than ring_chunk frames ahead of what has been published, so a snapshot of
+    // the largest FFT buffer stays valid as long as we have not lapped it
+    int i = 0;
+    while (i < frames) {
+        take_goertzel_bank(audio);
+        int end = i + audio->ring_chunk;
+        if (end > frames)
+            end = frames;
+
+        while (i < end) {
+            int n = end - i < CONVERT_FRAMES ? end - i : CONVERT_FRAMES;
+            sample_formats[format].convert(samples, in + (size_t)i * frame_bytes, 2 * n);
+            for (int j = 0; j < n; j++, pos++) {
+                dsp_real l = samples[j * 2], r = samples[j * 2 + 1];
+                if (audio->channels == 1) {
+                    if (audio->average)
+                        l = (l + r) / 2;
+                    if (audio->right)
+                        l = r;
+                    samples[j * 2] = l;
+                }
+                push_frame(audio, l, r, pos);
             }
-            if (audio->right) {
-                audio->in_bass_l_raw[n] = buf[i * 2 + 1];
+            if (audio->goertzel)
+                run_goertzel(audio->goertzel, samples, n, audio->channels);
+            i += n;
+        }
+
+        __atomic_store_n(&audio->write_pos, pos, __ATOMIC_SEQ_CST);
+    }
+    notify_input(audio);
+    return 0;
+}
+
+int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data) {
+    return write_input_frames((struct audio_data *)data, buf, frames, SAMPLE_S16);
+}
+
+static void window_from_ring(dsp_real *out, int stride, const dsp_real *ring,
+                             const dsp_real *multiplier, int size, unsigned int end,
+                             unsigned int mask) {
+    unsigned int start = end - size;
+    for (int i = 0; i < size; i++)
+        out[i * stride] = multiplier[i] * ring[(start + i) & mask];
+}
+
+// takes a consistent snapshot of the most recent frames into the FFT input buffers and applies the
+// Hann window, called from the main loop at frame time. Returns the number of frames that arrived
+// since the previous snapshot
+unsigned int read_fftw_input_buffers(struct audio_data *data) {
+    unsigned int end = 0;
+    int stride = data->fft_channels;
+
+    for (int retries = 0; retries < 3; retries++) {
+        end = __atomic_load_n(&data->write_pos, __ATOMIC_ACQUIRE);
+
+        for (int c = 0; c < data->fft_channels; c++) {
+            for (int b = 0; b < data->fft_band_count; b++) {
+                struct fft_band *band = &data->fft_bands[b];
+                struct input_level *level = &data->input_levels[band->level];
+                const dsp_real *ring = c == 0 ? level->ring_l : level->ring_r;
+                window_from_ring(band->in + c, stride, ring, band->multiplier, band->size,
+                                 end >> band->level, level->ring_size - 1);
             }
         }
-        // stereo storing channels in buffer
-        if (audio->channels == 2) {
-            audio->in_bass_l_raw[n] = buf[i * 2];
-            audio->in_bass_r_raw[n] = buf[i * 2 + 1];
 
-            audio->in_mid_r_raw[n] = audio->in_bass_r_raw[n];
-            audio->in_treble_r_raw[n] = audio->in_bass_r_raw[n];
+        // if the audio thread got far enough ahead to touch what we copied, take it again. gcc
+        // refuses fences under -fsanitize=thread, there the acquire load has to do
+#ifndef __SANITIZE_THREAD__
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+        if (__atomic_load_n(&data->write_pos, __ATOMIC_ACQUIRE) - end <= data->ring_slack)
+            break;
+    }
+
+    unsigned int new_frames = end - data->read_pos;
+    data->read_pos = end;
+    return new_frames;
+}
+
+// goertzel: filters for bars at omega radians per full rate frame with blocks of length frames, an
+// even number, and their magnitudes multiplied with scale
+struct goertzel_bank *new_goertzel_bank(int bar_count, const double *omega, const int *length,
+                                        const double *scale) {
+    static const double weight[GOERTZEL_RESONATORS] = {0.5, -0.25, -0.25};
+    struct goertzel_bank *bank = (struct goertzel_bank *)calloc(
+        1, sizeof(struct goertzel_bank) + bar_count * sizeof(struct goertzel_bar));
+
+    bank->bar_count = bar_count;
+    for (int n = 0; n < bar_count; n++) {
+        struct goertzel_bar *bar = &bank->bars[n];
+        double bin = 2 * M_PI / length[n];
+        const double shift[GOERTZEL_RESONATORS] = {0, -bin, bin};
+        bar->length = length[n];
+        bar->count[1] = -length[n] / 2;
+        for (int j = 0; j < GOERTZEL_RESONATORS; j++) {
+            double w = omega[n] + shift[j], gain = weight[j] * scale[n];
+            bar->coefficient[j] = 2 * cos(w);
+            // X(w) = e^(-iw(L - 1)) s1 - e^(-iwL) s2
+            bar->end_s1[j][0] = gain * cos(w * (length[n] - 1));
+            bar->end_s1[j][1] = -gain * sin(w * (length[n] - 1));
+            bar->end_s2[j][0] = gain * cos(w * length[n]);
+            bar->end_s2[j][1] = -gain * sin(w * length[n]);
         }
+    }
+    return bank;
+}
+
+// goertzel: hand the audio thread a new bank, it takes it over at its next block of frames. A bank
+// without bars stops the filters. Called from the main loop only, which also frees what the audio
+// thread is done with
+void set_goertzel_bank(struct audio_data *audio, struct goertzel_bank *bank) {
+    // one that was never picked up can go straight away
+    free(__atomic_exchange_n(&audio->goertzel_next, bank, __ATOMIC_ACQ_REL));
+    free(__atomic_exchange_n(&audio->goertzel_retired, NULL, __ATOMIC_ACQ_REL));
+}
 
-        audio->in_mid_l_raw[n] = audio->in_bass_l_raw[n];
-        audio->in_treble_l_raw[n] = audio->in_bass_l_raw[n];
-        n--;
+// goertzel: the latest magnitudes of every bar and channel. Zero until the audio thread has taken
+// the bank over and completed a block. Takes the place of read_fftw_input_buffers(), the rings are
+// not read, and returns the number of frames that arrived since the previous call the same way
+unsigned int read_goertzel_bars(struct audio_data *audio, const struct goertzel_bank *bank,
+                                dsp_real *temp[]) {
+    unsigned int end = __atomic_load_n(&audio->write_pos, __ATOMIC_ACQUIRE);
+    free(__atomic_exchange_n(&audio->goertzel_retired, NULL, __ATOMIC_ACQ_REL));
+    for (int c = 0; c < audio->fft_channels; c++) {
+        for (int n = 0; n < bank->bar_count; n++)
+            __atomic_load(&bank->bars[n].out[c], &temp[c][n], __ATOMIC_RELAXED);
     }
 
-    // Hann Window
-    for (int i = 0; i < audio->FFTbassbufferSize; i++) {
-        audio->in_bass_l[i] = audio->bass_multiplier[i] * audio->in_bass_l_raw[i];
-        if (audio->channels == 2)
-            audio->in_bass_r[i] = audio->bass_multiplier[i] * audio->in_bass_r_raw[i];
+    unsigned int new_frames = end - audio->read_pos;
+    audio->read_pos = end;
+    return new_frames;
+}
+
+// only once the audio thread has stopped
+void free_goertzel_banks(struct audio_data *audio) {
+    free(audio->goertzel);
+    free(audio->goertzel_next);
+    free(audio->goertzel_retired);
+    audio->goertzel = audio->goertzel_next = audio->goertzel_retired = NULL;
+}
+
+void init_input_wakeup(struct audio_data *data) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef NORT
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&data->input_cond, &attr);
+    pthread_cond_init(&data->offline_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&data->input_lock, NULL);
+    pthread_mutex_init(&data->offline_lock, NULL);
+    data->input_waiting = 0;
+}
+
+// timeout_ns from now on the clock the wakeup conditions wait on
+static struct timespec deadline_after(long timeout_ns) {
+    struct timespec deadline;
+#ifndef NORT
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+    clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+    deadline.tv_sec += timeout_ns / 1000000000;
+    deadline.tv_nsec += timeout_ns % 1000000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
     }
-    for (int i = 0; i < audio->FFTmidbufferSize; i++) {
-        audio->in_mid_l[i] = audio->mid_multiplier[i] * audio->in_mid_l_raw[i];
-        if (audio->channels == 2)
-            audio->in_mid_r[i] = audio->mid_multiplier[i] * audio->in_mid_r_raw[i];
+    return deadline;
+}
+
+// blocks until the audio thread has published frames newer than the last snapshot or reported a new
+// sample rate, or until timeout_ns has passed. Returns true if there is new audio to read
+bool wait_for_input(struct audio_data *data, long timeout_ns) {
+    struct timespec deadline = deadline_after(timeout_ns);
+
+    pthread_mutex_lock(&data->input_lock);
+    __atomic_store_n(&data->input_waiting, 1, __ATOMIC_SEQ_CST);
+    int err = 0;
+    while (__atomic_load_n(&data->write_pos, __ATOMIC_SEQ_CST) == data->read_pos &&
+           __atomic_load_n(&data->input_rate, __ATOMIC_SEQ_CST) == data->rate && !err &&
+           !data->terminate)
+        err = pthread_cond_timedwait(&data->input_cond, &data->input_lock, &deadline);
+    __atomic_store_n(&data->input_waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&data->input_lock);
+
+    return __atomic_load_n(&data->write_pos, __ATOMIC_ACQUIRE) != data->read_pos;
+}
+
+// offline: neither side is told about audio->terminate or a new rate, they look again this often
+#define OFFLINE_CHECK_NS 100000000
+
+void reset_offline(struct audio_data *audio) {
+    audio->offline_ready = audio->offline_taken = 0;
+    audio->offline_end = false;
+}
+
+void offline_frame_ready(struct audio_data *audio) {
+    pthread_mutex_lock(&audio->offline_lock);
+    audio->offline_ready++;
+    pthread_cond_broadcast(&audio->offline_cond);
+    while (audio->offline_taken != audio->offline_ready && !audio->terminate) {
+        struct timespec deadline = deadline_after(OFFLINE_CHECK_NS);
+        pthread_cond_timedwait(&audio->offline_cond, &audio->offline_lock, &deadline);
     }
-    for (int i = 0; i < audio->FFTtreblebufferSize; i++) {
-        audio->in_treble_l[i] = audio->treble_multiplier[i] * audio->in_treble_l_raw[i];
-        if (audio->channels == 2)
-            audio->in_treble_r[i] = audio->treble_multiplier[i] * audio->in_treble_r_raw[i];
+    pthread_mutex_unlock(&audio->offline_lock);
+}
+
+void offline_input_end(struct audio_data *audio) {
+    pthread_mutex_lock(&audio->offline_lock);
+    __atomic_store_n(&audio->offline_end, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&audio->offline_cond);
+    pthread_mutex_unlock(&audio->offline_lock);
+}
+
+bool offline_next_frame(struct audio_data *audio) {
+    pthread_mutex_lock(&audio->offline_lock);
+    while (audio->offline_ready == audio->offline_taken && !audio->offline_end &&
+           !audio->terminate &&
+           __atomic_load_n(&audio->input_rate, __ATOMIC_ACQUIRE) == audio->rate) {
+        struct timespec deadline = deadline_after(OFFLINE_CHECK_NS);
+        pthread_cond_timedwait(&audio->offline_cond, &audio->offline_lock, &deadline);
     }
-    return 0;
+    bool more = !audio->offline_end || audio->offline_ready != audio->offline_taken;
+    pthread_mutex_unlock(&audio->offline_lock);
+    return more;
+}
+
+void offline_frame_taken(struct audio_data *audio) {
+    pthread_mutex_lock(&audio->offline_lock);
+    if (audio->offline_taken != audio->offline_ready)
+        audio->offline_taken++;
+    pthread_cond_broadcast(&audio->offline_cond);
+    pthread_mutex_unlock(&audio->offline_lock);
+}
+
+bool input_ended(struct audio_data *audio) {
+    return __atomic_load_n(&audio->offline_end, __ATOMIC_ACQUIRE);
 }
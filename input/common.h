@@ -11,24 +11,114 @@
 #include <string.h>
 #include <unistd.h>
 
+// sample type of the DSP path, from the ring buffers to the bar sums. Bar heights end up as small
+// ints, so configure --enable-float builds it on single precision FFTW
+#ifdef FLOAT_DSP
+typedef float dsp_real;
+#else
+typedef double dsp_real;
+#endif
+
+// bands that only cover low frequencies analyse the input decimated by 2, 4, ... Every level
+// halves the rate of the one before it through a halfband lowpass of DECIMATOR_TAPS taps
+#define MAX_INPUT_LEVELS 8
+#define DECIMATOR_TAPS 47
+
+// one FFT resolution band, bands are ordered from the largest FFT (lowest frequencies) down
+struct fft_band {
+    int size;             // FFT size at the rate of its input level
+    int level;            // reads the input decimated by 2^level
+    dsp_real *multiplier; // Hann window
+    dsp_real *in;         // FFT input with the channels interleaved, in[i * fft_channels + channel]
+};
+
+// the input at one rate, level 0 is the full rate
+struct input_level {
+    dsp_real *ring_l, *ring_r;
+    unsigned int ring_size; // in samples at the rate of this level, a power of two
+    // the last DECIMATOR_TAPS samples of the level above, stored twice so the filter can read them
+    // as one block
+    dsp_real hist_l[2 * DECIMATOR_TAPS], hist_r[2 * DECIMATOR_TAPS];
+    int hist_pos;
+};
+
+// goertzel: the filter of one bar. Three resonators at its centre frequency and one Hann bin either
+// side of it add up to the DFT of a Hann windowed block, two sets of them run half a block apart
+#define GOERTZEL_RESONATORS 3
+
+struct goertzel_bar {
+    int length;   // block length in full rate frames
+    int count[2]; // frames into the current block of each set, < 0 before it
+    double coefficient[GOERTZEL_RESONATORS]; // 2 cos(w) of each resonator
+    // turn the last two states into the windowed DFT, re and im
+    double end_s1[GOERTZEL_RESONATORS][2], end_s2[GOERTZEL_RESONATORS][2];
+    double s1[2][2][GOERTZEL_RESONATORS], s2[2][2][GOERTZEL_RESONATORS]; // [channel][set]
+    dsp_real out[2]; // magnitude of the last complete block per channel
+};
+
+struct goertzel_bank {
+    int bar_count;
+    struct goertzel_bar bars[];
+};
+
+// input: sample formats the backends can hand over, interleaved stereo in native byte order or
+// byte swapped. SAMPLE_S24 is 24 bit in the low bytes of 32, SAMPLE_S24_3LE and SAMPLE_S24_3BE are
+// packed into 3 bytes and SAMPLE_FLOAT runs from -1 to 1
+enum sample_format {
+    SAMPLE_S16,
+    SAMPLE_S16_SWAPPED,
+    SAMPLE_S24,
+    SAMPLE_S24_3LE,
+    SAMPLE_S24_3BE,
+    SAMPLE_S32,
+    SAMPLE_S32_SWAPPED,
+    SAMPLE_FLOAT,
+    SAMPLE_FLOAT_SWAPPED
+};
+
+struct input_recorder;
+
 struct audio_data {
-    int FFTbassbufferSize;
-    int FFTmidbufferSize;
-    int FFTtreblebufferSize;
-    int bass_index;
-    int mid_index;
-    int treble_index;
-    double *bass_multiplier;
-    double *mid_multiplier;
-    double *treble_multiplier;
-    double *in_bass_r_raw, *in_bass_l_raw;
-    double *in_mid_r_raw, *in_mid_l_raw;
-    double *in_treble_r_raw, *in_treble_l_raw;
-    double *in_bass_r, *in_bass_l;
-    double *in_mid_r, *in_mid_l;
-    double *in_treble_r, *in_treble_l;
+    struct fft_band *fft_bands;
+    int fft_band_count;
+    int fft_channels;
+    int input_buffer_size; // frames the input backends read at a time
+    // single-producer/single-consumer rings of input samples per channel and level. The audio
+    // thread only appends to them, the main loop copies the most recent samples into the FFT input
+    // at frame time
+    struct input_level input_levels[MAX_INPUT_LEVELS];
+    int input_level_count;
+    unsigned int ring_chunk; // most full rate frames written before publishing them
+    unsigned int ring_slack; // how far write_pos may move during a snapshot without tearing it
+    // full rate frames of silence that clear the largest FFT and the decimation filters. Fixed with
+    // the rings, so the audio thread never looks at the FFT bands the main loop may rebuild
+    unsigned int reset_frames;
+    unsigned int write_pos; // full rate frames written so far, published by the audio thread
+    unsigned int read_pos;  // write_pos at the last snapshot, only used by the main loop
+    // lets the main loop sleep until the audio thread has published new frames
+    pthread_mutex_t input_lock;
+    pthread_cond_t input_cond;
+    int input_waiting;
+    // offline: the file input hands over the audio of one rendered frame at a time, frames it has
+    // handed over and the main loop has taken its snapshot of, see offline_frame_ready()
+    bool offline;
+    int framerate;
+    unsigned int offline_ready, offline_taken;
+    bool offline_end; // the input has nothing more to hand over, see input_ended()
+    pthread_mutex_t offline_lock;
+    pthread_cond_t offline_cond;
+    // goertzel: the bank the audio thread runs, the one the main loop handed it next and the one it
+    // is done with, see set_goertzel_bank()
+    struct goertzel_bank *goertzel, *goertzel_next, *goertzel_retired;
+    // record: the log everything the input writes goes to as well, NULL when not recording
+    struct input_recorder *recorder;
     int format;
-    unsigned int rate;
+    int fifo_format; // fifo: enum fifo_format of the samples it reads
+    int latency;     // pulse, sndio: target capture latency in ms, 0 for their default
+    int block_size;  // synthetic: frames generated at a time
+    double speed;    // synthetic, replay: times realtime, 0 renders offline
+    unsigned int rate;       // rate the FFT bands are sized for, only changed by the main loop
+    unsigned int input_rate; // rate the audio thread delivers, see set_input_rate()
     char *source; // alsa device, fifo path or pulse source
     int im;       // input mode alsa, fifo or pulse
     unsigned int channels;
@@ -37,8 +127,54 @@ struct audio_data {
     char error_message[1024];
 };
 
+void init_input_rings(struct audio_data *audio);
+
+void free_input_rings(struct audio_data *audio);
+
 void reset_output_buffers(struct audio_data *data);
 
+void set_input_rate(struct audio_data *audio, unsigned int rate);
+
+int sample_format_bytes(enum sample_format format);
+
+// converts and appends frames of the given format, without losing the resolution of formats wider
+// than 16 bit
+int write_input_frames(struct audio_data *audio, const void *buf, int frames,
+                       enum sample_format format);
+
+// the same for 16 bit frames
 int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data);
 
-extern pthread_mutex_t lock;
+unsigned int read_fftw_input_buffers(struct audio_data *data);
+
+struct goertzel_bank *new_goertzel_bank(int bar_count, const double *omega, const int *length,
+                                        const double *scale);
+
+void set_goertzel_bank(struct audio_data *audio, struct goertzel_bank *bank);
+
+unsigned int read_goertzel_bars(struct audio_data *audio, const struct goertzel_bank *bank,
+                                dsp_real *temp[]);
+
+void free_goertzel_banks(struct audio_data *audio);
+
+void init_input_wakeup(struct audio_data *data);
+
+bool wait_for_input(struct audio_data *data, long timeout_ns);
+
+// offline: every output frame covers exactly the audio the input handed over for it, however long
+// rendering takes. The input calls offline_frame_ready() after writing the frames of one and waits
+// there until the main loop has its snapshot, so it can go on with the next while that is drawn
+void reset_offline(struct audio_data *audio);
+
+void offline_frame_ready(struct audio_data *audio);
+
+void offline_input_end(struct audio_data *audio);
+
+// main loop: waits for the next frame, false once the input has ended. offline_frame_taken() lets
+// the input go on once nothing more is read for it
+bool offline_next_frame(struct audio_data *audio);
+
+void offline_frame_taken(struct audio_data *audio);
+
+// true once an input that runs out, like a replayed log, has called offline_input_end()
+bool input_ended(struct audio_data *audio);
@@ -1,80 +1,80 @@
 #include "input/fifo.h"
+#include "config.h"
 #include "input/common.h"
 
-#include <time.h>
+#include <poll.h>
 
-int open_fifo(const char *path) {
-    int fd = open(path, O_RDONLY);
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    return fd;
+// how long the fifo may stay quiet before the bars fall to zero, in ms
+#define FIFO_SILENCE_TIMEOUT 100
+
+// opening without a writer does not wait for one, poll() does
+int open_fifo(const char *path) { return open(path, O_RDONLY | O_NONBLOCK); }
+
+// the converter for a fifo format, the ones in the byte order of this machine need no swapping
+enum sample_format fifo_sample_format(enum fifo_format format) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const bool big_endian = true;
+#else
+    const bool big_endian = false;
+#endif
+    switch (format) {
+    case FIFO_S16BE:
+        return big_endian ? SAMPLE_S16 : SAMPLE_S16_SWAPPED;
+    case FIFO_S24LE:
+        return SAMPLE_S24_3LE;
+    case FIFO_S24BE:
+        return SAMPLE_S24_3BE;
+    case FIFO_S32LE:
+        return big_endian ? SAMPLE_S32_SWAPPED : SAMPLE_S32;
+    case FIFO_S32BE:
+        return big_endian ? SAMPLE_S32 : SAMPLE_S32_SWAPPED;
+    case FIFO_F32LE:
+        return big_endian ? SAMPLE_FLOAT_SWAPPED : SAMPLE_FLOAT;
+    case FIFO_F32BE:
+        return big_endian ? SAMPLE_FLOAT : SAMPLE_FLOAT_SWAPPED;
+    default:
+        return big_endian ? SAMPLE_S16_SWAPPED : SAMPLE_S16;
+    }
 }
 
 // input: FIFO
 void *input_fifo(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
-    int SAMPLES_PER_BUFFER = audio->FFTtreblebufferSize * 2;
-    int bytes_per_sample = audio->format / 8;
-    __attribute__((aligned(sizeof(uint16_t)))) uint8_t buf[SAMPLES_PER_BUFFER * bytes_per_sample];
-    uint16_t *samples =
-        bytes_per_sample == 2 ? (uint16_t *)&buf : calloc(SAMPLES_PER_BUFFER, sizeof(uint16_t));
+    enum sample_format format = fifo_sample_format(audio->fifo_format);
+    size_t frame_bytes = 2 * sample_format_bytes(format);
+    size_t size = audio->input_buffer_size * frame_bytes;
+    uint8_t *buf = malloc(size);
+    size_t offset = 0; // bytes of a frame that was only partly read
 
-    int fd = open_fifo(audio->source);
+    struct pollfd fifo = {.fd = open_fifo(audio->source), .events = POLLIN};
 
     while (!audio->terminate) {
-        int time_since_last_input = 0;
-        unsigned int offset = 0;
-        do {
-            int num_read = read(fd, buf + offset, sizeof(buf) - offset);
-
-            if (num_read < 1) { // if no bytes read sleep 10ms and zero shared buffer
-                nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 10000000}, NULL);
-                time_since_last_input++;
-
-                if (time_since_last_input > 10) {
-                    reset_output_buffers(audio);
-                    close(fd);
-
-                    fd = open_fifo(audio->source);
-                    time_since_last_input = 0;
-                    offset = 0;
-                }
-            } else {
-                offset += num_read;
-                time_since_last_input = 0;
-            }
-        } while (offset < sizeof(buf));
-
-        switch (bytes_per_sample) {
-        case 2:
-            // [samples] = [buf] so there's nothing to do here.
-            break;
-        case 3:
-            for (int i = 0; i < SAMPLES_PER_BUFFER; i++) {
-                // Really, a sample is composed of buf[3i + 2] | buf[3i + 1] | buf[3i], but our FFT
-                // only takes 16-bit samples. Since we need to scale them eventually, we can just
-                // do so here by taking the top 2 bytes.
-                samples[i] = (buf[3 * i + 2] << 8) | buf[3 * i + 1];
-            }
-            break;
-        case 4:
-            for (int i = 0; i < SAMPLES_PER_BUFFER; i++) {
-                samples[i] = (buf[4 * i + 3] << 8) | buf[4 * i + 2];
-            }
-            break;
+        // sleep until the writer delivers and pass on whatever whole frames came in, a quiet fifo
+        // zeroes the shared buffers every FIFO_SILENCE_TIMEOUT
+        if (poll(&fifo, 1, FIFO_SILENCE_TIMEOUT) == 0) {
+            reset_output_buffers(audio);
+            continue;
         }
 
-        // We worked with unsigned ints up until now to save on sign extension, but the FFT wants
-        // signed ints.
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(SAMPLES_PER_BUFFER / 2, (int16_t *)samples, audio);
-        pthread_mutex_unlock(&lock);
+        ssize_t num_read = read(fifo.fd, buf + offset, size - offset);
+        if (num_read > 0) {
+            offset += num_read;
+            size_t frames = offset / frame_bytes;
+            write_input_frames(audio, buf, frames, format);
+            offset -= frames * frame_bytes;
+            memmove(buf, buf + frames * frame_bytes, offset);
+        } else if (num_read == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // the writer is gone. A new descriptor waits for the next one, the old one would keep
+            // polling as hung up
+            reset_output_buffers(audio);
+            close(fifo.fd);
+            fifo.fd = open_fifo(audio->source);
+            offset = 0;
+        }
     }
 
-    close(fd);
-    if (bytes_per_sample != 2) {
-        free(samples);
-    }
+    close(fifo.fd);
+    free(buf);
 
     return 0;
 }
@@ -2,4 +2,10 @@
 
 #pragma once
 
+#include "config.h"
+#include "input/common.h"
+
 void *input_fifo(void *data);
+
+// the converter for samples stored as a fifo format, raw pcm files use them too
+enum sample_format fifo_sample_format(enum fifo_format format);
@@ -0,0 +1,163 @@
+#include "input/file.h"
+#include "debug.h"
+#include "input/common.h"
+#include "input/fifo.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// file: frames of a file of other than two channels are copied to stereo this many at a time
+#define STEREO_FRAMES 1024
+
+// the samples of a wav file or of headerless pcm, straight from the mapped file
+struct pcm {
+    const uint8_t *data;
+    size_t frames;
+    int channels;
+    int sample_bytes;
+    unsigned int rate;
+    enum sample_format format;
+};
+
+static uint32_t le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t le32(const uint8_t *p) { return le16(p) | (uint32_t)le16(p + 2) << 16; }
+
+// file [wav]: finds the fmt and data chunks, false if it is no RIFF WAVE file at all
+static bool parse_wav(const uint8_t *map, size_t size, struct pcm *pcm, const char *path) {
+    if (size < 12 || memcmp(map, "RIFF", 4) != 0 || memcmp(map + 8, "WAVE", 4) != 0)
+        return false;
+
+    const uint8_t *fmt = NULL;
+    pcm->data = NULL;
+    for (size_t at = 12; at + 8 <= size && !(fmt && pcm->data);) {
+        size_t length = le32(map + at + 4);
+        if (length > size - at - 8)
+            length = size - at - 8;
+        if (memcmp(map + at, "fmt ", 4) == 0 && length >= 16)
+            fmt = map + at + 8;
+        else if (memcmp(map + at, "data", 4) == 0) {
+            pcm->data = map + at + 8;
+            pcm->frames = length;
+        }
+        at += 8 + length + (length & 1);
+    }
+    if (!fmt || !pcm->data) {
+        fprintf(stderr, __FILE__ ": %s has no audio\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // WAVE_FORMAT_EXTENSIBLE has the real format tag at the start of its sub format GUID
+    unsigned int tag = le16(fmt);
+    if (tag == 0xfffe && le16(fmt + 16) >= 22)
+        tag = le16(fmt + 24);
+    pcm->channels = le16(fmt + 2);
+    pcm->rate = le32(fmt + 4);
+    int bits = le16(fmt + 14);
+    pcm->sample_bytes = (bits + 7) / 8;
+
+    enum fifo_format format = FIFO_FORMAT_MAX;
+    if (tag == 1 && bits == 16)
+        format = FIFO_S16LE;
+    else if (tag == 1 && bits == 24)
+        format = FIFO_S24LE;
+    else if (tag == 1 && bits == 32)
+        format = FIFO_S32LE;
+    else if (tag == 3 && bits == 32)
+        format = FIFO_F32LE;
+    if (format == FIFO_FORMAT_MAX || pcm->channels < 1 || pcm->rate == 0) {
+        fprintf(stderr, __FILE__ ": %s is %d bit audio of format %u, supported are 16, 24 and 32 "
+                        "bit integer and 32 bit float\n",
+                path, bits, tag);
+        exit(EXIT_FAILURE);
+    }
+    pcm->format = fifo_sample_format(format);
+    pcm->frames /= pcm->channels * pcm->sample_bytes;
+    return true;
+}
+
+// hands frames from to to on, the first two channels of a file with more and a mono file on both.
+// A wav data chunk may start on any even offset, so stereo samples are converted where they are in
+// the mapping only if that keeps them aligned
+static void write_frames(struct audio_data *audio, const struct pcm *pcm, size_t from, size_t to,
+                         uint8_t *stereo) {
+    size_t frame_bytes = pcm->channels * pcm->sample_bytes;
+    if (pcm->channels == 2 && (uintptr_t)pcm->data % sizeof(float) == 0) {
+        write_input_frames(audio, pcm->data + from * frame_bytes, to - from, pcm->format);
+        return;
+    }
+
+    int right = pcm->channels > 1 ? pcm->sample_bytes : 0;
+    while (from < to) {
+        int n = to - from < STEREO_FRAMES ? to - from : STEREO_FRAMES;
+        if (pcm->channels == 2) {
+            memcpy(stereo, pcm->data + from * frame_bytes, n * frame_bytes);
+        } else {
+            for (int f = 0; f < n; f++) {
+                const uint8_t *in = pcm->data + (from + f) * frame_bytes;
+                memcpy(stereo + 2 * f * pcm->sample_bytes, in, pcm->sample_bytes);
+                memcpy(stereo + (2 * f + 1) * pcm->sample_bytes, in + right, pcm->sample_bytes);
+            }
+        }
+        write_input_frames(audio, stereo, n, pcm->format);
+        from += n;
+    }
+}
+
+// input: file. Renders a wav or raw pcm file offline, every output frame gets the next
+// 1 / framerate seconds of it and cava quits at the end, as fast as the frames are drawn
+void *input_file(void *data) {
+    struct audio_data *audio = (struct audio_data *)data;
+
+    int fd = open(audio->source, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, __FILE__ ": could not open %s: %s\n", audio->source, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    size_t size = st.st_size;
+    const uint8_t *map = NULL;
+    if (size > 0) {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, __FILE__ ": could not map %s: %s\n", audio->source, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        posix_madvise((void *)map, size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    // anything but a wav file is taken as stereo pcm of the configured format and rate
+    struct pcm pcm;
+    if (!parse_wav(map, size, &pcm, audio->source)) {
+        pcm.format = fifo_sample_format(audio->fifo_format);
+        pcm.channels = 2;
+        pcm.sample_bytes = sample_format_bytes(pcm.format);
+        pcm.rate = audio->input_rate;
+        pcm.data = map;
+        pcm.frames = size / (2 * pcm.sample_bytes);
+    }
+    debug("file: %zu frames of %d channels at %u Hz\n", pcm.frames, pcm.channels, pcm.rate);
+
+    audio->format = 8 * pcm.sample_bytes;
+    set_input_rate(audio, pcm.rate);
+    uint8_t *stereo = (uint8_t *)malloc(2 * STEREO_FRAMES * pcm.sample_bytes);
+
+    // frame k ends at the audio frame k * rate / framerate, so the frames do not drift
+    unsigned long long framerate = audio->framerate > 0 ? audio->framerate : 1;
+    size_t pos = 0;
+    for (unsigned long long k = 1; pos < pcm.frames && !audio->terminate; k++) {
+        size_t end = k * pcm.rate / framerate;
+        if (end > pcm.frames)
+            end = pcm.frames;
+        write_frames(audio, &pcm, pos, end, stereo);
+        pos = end;
+        offline_frame_ready(audio);
+    }
+    offline_input_end(audio);
+
+    free(stereo);
+    if (map)
+        munmap((void *)map, size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,5 @@
+// header file for file, part of cava.
+
+#pragma once
+
+void *input_file(void *data);
@@ -0,0 +1,176 @@
+#include "input/jack.h"
+#include "debug.h"
+#include "input/common.h"
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <time.h>
+
+// jack: how long the input thread sleeps when the ring is empty before it looks at
+// audio->terminate again, in ns
+#define JACK_WAIT_TIMEOUT 100000000
+
+// jack: the process callback runs on the realtime thread of the server. It only interleaves the two
+// ports into a wait-free ring, the input thread takes the frames from there, so the callback never
+// waits on a lock or does the DSP work of write_input_frames
+struct jack_input {
+    struct audio_data *audio;
+    jack_client_t *client;
+    jack_port_t *ports[2];
+    jack_ringbuffer_t *ring; // interleaved float frames
+    unsigned int rate;       // set by the server's sample rate callback
+    // wakes the input thread, the callback only signals if it gets the lock right away. A wakeup
+    // missed that way is made up for by the next period
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static const size_t frame_bytes = 2 * sizeof(float);
+
+static int process(jack_nframes_t nframes, void *arg) {
+    struct jack_input *in = (struct jack_input *)arg;
+    const float *left = (const float *)jack_port_get_buffer(in->ports[0], nframes);
+    const float *right = (const float *)jack_port_get_buffer(in->ports[1], nframes);
+
+    // frames that do not fit are dropped, the input thread is behind and they would be stale
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(in->ring, vec);
+    jack_nframes_t n = 0;
+    for (int i = 0; i < 2 && n < nframes; i++) {
+        float *out = (float *)vec[i].buf;
+        for (size_t f = 0; f < vec[i].len / frame_bytes && n < nframes; f++, n++) {
+            out[2 * f] = left[n];
+            out[2 * f + 1] = right[n];
+        }
+    }
+    jack_ringbuffer_write_advance(in->ring, n * frame_bytes);
+
+    if (pthread_mutex_trylock(&in->lock) == 0) {
+        pthread_cond_signal(&in->cond);
+        pthread_mutex_unlock(&in->lock);
+    }
+    return 0;
+}
+
+static int sample_rate(jack_nframes_t rate, void *arg) {
+    struct jack_input *in = (struct jack_input *)arg;
+    __atomic_store_n(&in->rate, rate, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void server_shutdown(void *arg) {
+    struct jack_input *in = (struct jack_input *)arg;
+    sprintf(in->audio->error_message, __FILE__ ": the jack server shut down\n");
+    in->audio->terminate = 1;
+}
+
+// jack: connect our inputs to the output ports matching source, by default the physical capture
+// ports. A single matching port goes to both inputs, 'none' leaves the wiring to the user
+static void connect_ports(struct jack_input *in, const char *source) {
+    if (strcmp(source, "none") == 0)
+        return;
+
+    const char **ports;
+    if (strcmp(source, "auto") == 0)
+        ports = jack_get_ports(in->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+                               JackPortIsPhysical | JackPortIsOutput);
+    else
+        ports = jack_get_ports(in->client, source, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput);
+    if (!ports || !ports[0]) {
+        fprintf(stderr, __FILE__ ": no jack output ports match '%s'\n", source);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int c = 0; c < 2; c++) {
+        const char *port = ports[1] ? ports[c] : ports[0];
+        if (jack_connect(in->client, port, jack_port_name(in->ports[c])) != 0)
+            fprintf(stderr, __FILE__ ": could not connect %s\n", port);
+        else
+            debug("connected %s\n", port);
+    }
+    jack_free(ports);
+}
+
+void *input_jack(void *data) {
+    struct audio_data *audio = (struct audio_data *)data;
+    struct jack_input in = {.audio = audio};
+    jack_status_t status;
+
+    in.client = jack_client_open("cava", JackNoStartServer, &status);
+    if (!in.client) {
+        fprintf(stderr, __FILE__ ": could not connect to the jack server, status 0x%x\n", status);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *names[2] = {"in_l", "in_r"};
+    for (int c = 0; c < 2; c++)
+        in.ports[c] =
+            jack_port_register(in.client, names[c], JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    if (!in.ports[0] || !in.ports[1]) {
+        fprintf(stderr, __FILE__ ": could not register jack ports\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // room for a few periods of the server and of what cava reads at a time, locked into memory
+    // so the callback does not page fault on it
+    size_t frames = 4 * ((size_t)jack_get_buffer_size(in.client) + audio->input_buffer_size);
+    in.ring = jack_ringbuffer_create(frames * frame_bytes);
+    jack_ringbuffer_mlock(in.ring);
+    pthread_mutex_init(&in.lock, NULL);
+    pthread_cond_init(&in.cond, NULL);
+
+    audio->format = 32;
+    in.rate = jack_get_sample_rate(in.client);
+    set_input_rate(audio, in.rate);
+
+    jack_set_process_callback(in.client, process, &in);
+    jack_set_sample_rate_callback(in.client, sample_rate, &in);
+    jack_on_shutdown(in.client, server_shutdown, &in);
+    if (jack_activate(in.client) != 0) {
+        fprintf(stderr, __FILE__ ": could not activate the jack client\n");
+        exit(EXIT_FAILURE);
+    }
+    connect_ports(&in, audio->source);
+
+    while (!audio->terminate) {
+        unsigned int rate = __atomic_load_n(&in.rate, __ATOMIC_ACQUIRE);
+        if (rate != audio->input_rate) {
+            // frames already in the ring are from the old rate
+            set_input_rate(audio, rate);
+            jack_ringbuffer_read_advance(in.ring, jack_ringbuffer_read_space(in.ring) /
+                                                      frame_bytes * frame_bytes);
+        }
+
+        // the frames may wrap around the end of the ring, then they come in two pieces, both
+        // converted where they are
+        jack_ringbuffer_data_t vec[2];
+        jack_ringbuffer_get_read_vector(in.ring, vec);
+        size_t read = 0;
+        for (int i = 0; i < 2; i++) {
+            write_input_frames(audio, vec[i].buf, vec[i].len / frame_bytes, SAMPLE_FLOAT);
+            read += vec[i].len / frame_bytes * frame_bytes;
+        }
+        jack_ringbuffer_read_advance(in.ring, read);
+        if (read > 0)
+            continue;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += JACK_WAIT_TIMEOUT;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&in.lock);
+        if (jack_ringbuffer_read_space(in.ring) < frame_bytes)
+            pthread_cond_timedwait(&in.cond, &in.lock, &deadline);
+        pthread_mutex_unlock(&in.lock);
+    }
+
+    jack_deactivate(in.client);
+    jack_client_close(in.client);
+    jack_ringbuffer_free(in.ring);
+    pthread_cond_destroy(&in.cond);
+    pthread_mutex_destroy(&in.lock);
+    return 0;
+}
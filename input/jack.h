@@ -0,0 +1,5 @@
+// header file for jack, part of cava.
+
+#pragma once
+
+void *input_jack(void *data);
@@ -2,66 +2,64 @@
 #include "input/common.h"
 
 #include <portaudio.h>
+#include <time.h>
 
-#define SAMPLE_SILENCE -32767
 #define PA_SAMPLE_TYPE paInt16
 typedef short SAMPLE;
 
-typedef struct {
-    int frameIndex; /* Index into sample array. */
-    int maxFrameIndex;
-    SAMPLE *recordedSamples;
-} paTestData;
+// portaudio: how long the input thread waits for the callback before it looks at audio->terminate
+// and the stream again, in ns
+#define PORTAUDIO_WAIT_TIMEOUT 100000000
+
+// portaudio: the callback may run on a realtime thread, so it only copies the frames into a
+// single-producer/single-consumer ring and signals the input thread if it gets the lock right away.
+// The input thread converts them from there, it stays the only writer of the input rings
+struct portaudio_ring {
+    SAMPLE *frames;    // interleaved stereo
+    unsigned int size; // in frames, a power of two
+    unsigned int write_pos, read_pos; // frames written and read so far, wrapping
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
 
 static struct audio_data *audio;
-int16_t silence_buffer[8092] = {SAMPLE_SILENCE};
+
+static void wake_input(struct portaudio_ring *ring) {
+    if (pthread_mutex_trylock(&ring->lock) == 0) {
+        pthread_cond_signal(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
 
 static int recordCallback(const void *inputBuffer, void *outputBuffer,
                           unsigned long framesPerBuffer, const PaStreamCallbackTimeInfo *timeInfo,
                           PaStreamCallbackFlags statusFlags, void *userData) {
-    paTestData *data = (paTestData *)userData;
-    SAMPLE *rptr = (SAMPLE *)inputBuffer;
-    long framesToCalc;
-    int finished;
-    unsigned long framesLeft = data->maxFrameIndex - data->frameIndex;
+    struct portaudio_ring *ring = (struct portaudio_ring *)userData;
+    const SAMPLE *rptr = (const SAMPLE *)inputBuffer;
     (void)outputBuffer; // Prevent unused variable warnings.
     (void)timeInfo;
     (void)statusFlags;
-    (void)userData;
-
-    if (framesLeft < framesPerBuffer) {
-        framesToCalc = framesLeft;
-        finished = paComplete;
-    } else {
-        framesToCalc = framesPerBuffer;
-        finished = paContinue;
-    }
-
-    pthread_mutex_lock(&lock);
 
-    if (inputBuffer == NULL)
-        write_to_fftw_input_buffers(framesToCalc, silence_buffer, audio);
-    else
-        write_to_fftw_input_buffers(framesToCalc, rptr, audio);
-
-    pthread_mutex_unlock(&lock);
-
-    data->frameIndex += framesToCalc;
-    if (finished == paComplete) {
-        data->frameIndex = 0;
-        finished = paContinue;
+    // frames that do not fit are dropped, the input thread is behind and they would be stale
+    unsigned int w = ring->write_pos;
+    unsigned int space = ring->size - (w - __atomic_load_n(&ring->read_pos, __ATOMIC_ACQUIRE));
+    unsigned int frames = framesPerBuffer < space ? framesPerBuffer : space;
+    for (unsigned int n = 0; n < frames;) {
+        unsigned int at = (w + n) & (ring->size - 1);
+        unsigned int chunk = ring->size - at < frames - n ? ring->size - at : frames - n;
+        if (rptr == NULL)
+            memset(ring->frames + 2 * at, 0, chunk * 2 * sizeof(SAMPLE));
+        else
+            memcpy(ring->frames + 2 * at, rptr + 2 * n, chunk * 2 * sizeof(SAMPLE));
+        n += chunk;
     }
+    __atomic_store_n(&ring->write_pos, w + frames, __ATOMIC_RELEASE);
 
-    if (audio->terminate == 1)
-        finished = paComplete;
-
-    return finished;
+    wake_input(ring);
+    return audio->terminate == 1 ? paComplete : paContinue;
 }
 
-void portaudio_simple_free(paTestData data) {
-    Pa_Terminate();
-    free(data.recordedSamples);
-}
+static void streamFinished(void *userData) { wake_input((struct portaudio_ring *)userData); }
 
 void *input_portaudio(void *audiodata) {
     audio = (struct audio_data *)audiodata;
@@ -69,7 +67,6 @@ void *input_portaudio(void *audiodata) {
     PaStreamParameters inputParameters;
     PaStream *stream;
     PaError err = paNoError;
-    paTestData data;
 
     // start portaudio
     err = Pa_Initialize();
@@ -124,14 +121,17 @@ void *input_portaudio(void *audiodata) {
     }
     inputParameters.device = deviceNum;
 
-    // set parameters
-    data.maxFrameIndex = audio->FFTtreblebufferSize * 1024;
-    data.recordedSamples = (SAMPLE *)malloc(2 * data.maxFrameIndex * sizeof(SAMPLE));
-    if (data.recordedSamples == NULL) {
+    // room for a few buffers of what cava reads at a time
+    struct portaudio_ring ring = {.size = 1};
+    while (ring.size < 4 * (unsigned int)audio->input_buffer_size)
+        ring.size *= 2;
+    ring.frames = (SAMPLE *)malloc(2 * ring.size * sizeof(SAMPLE));
+    if (ring.frames == NULL) {
         fprintf(stderr, "Error: failure in memory allocation!\n");
         exit(EXIT_FAILURE);
-    } else
-        memset(data.recordedSamples, 0x00, 2 * data.maxFrameIndex);
+    }
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.cond, NULL);
 
     inputParameters.channelCount = 2;
     inputParameters.sampleFormat = PA_SAMPLE_TYPE;
@@ -140,45 +140,68 @@ void *input_portaudio(void *audiodata) {
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
     // set it to work
-    err = Pa_OpenStream(&stream, &inputParameters, NULL, audio->rate, audio->FFTtreblebufferSize,
-                        paClipOff, recordCallback, &data);
+    err = Pa_OpenStream(&stream, &inputParameters, NULL, audio->rate, audio->input_buffer_size,
+                        paClipOff, recordCallback, &ring);
     if (err != paNoError) {
         fprintf(stderr, "Error: failure in opening stream (%x)\n", err);
         exit(EXIT_FAILURE);
     }
 
-    // main loop
-    while (1) {
-        // start recording
-        data.frameIndex = 0;
-        err = Pa_StartStream(stream);
-        if (err != paNoError) {
-            fprintf(stderr, "Error: failure in starting stream (%x)\n", err);
-            exit(EXIT_FAILURE);
-        }
+    Pa_SetStreamFinishedCallback(stream, streamFinished);
+    err = Pa_StartStream(stream);
+    if (err != paNoError) {
+        fprintf(stderr, "Error: failure in starting stream (%x)\n", err);
+        exit(EXIT_FAILURE);
+    }
 
-        //  record
-        while ((err = Pa_IsStreamActive(stream)) == 1) {
-            Pa_Sleep(1000);
-            if (audio->terminate == 1)
-                break;
+    // record until told to stop, woken by every callback and when the stream finishes
+    while (audio->terminate != 1) {
+        unsigned int r = ring.read_pos;
+        unsigned int frames = __atomic_load_n(&ring.write_pos, __ATOMIC_ACQUIRE) - r;
+        if (frames > 0) {
+            // the frames may wrap around the end of the ring, then they come in two pieces, both
+            // converted where they are
+            unsigned int at = r & (ring.size - 1);
+            unsigned int first = ring.size - at < frames ? ring.size - at : frames;
+            write_input_frames(audio, ring.frames + 2 * at, first, SAMPLE_S16);
+            write_input_frames(audio, ring.frames, frames - first, SAMPLE_S16);
+            __atomic_store_n(&ring.read_pos, r + frames, __ATOMIC_RELEASE);
+            continue;
         }
-        // check for errors
-        if (err < 0) {
+
+        // the callback completes the stream once audio->terminate is set, a stream that is no
+        // longer active is a clean end. Only an error means recording failed
+        if (audio->terminate == 1)
+            break;
+        if ((err = Pa_IsStreamActive(stream)) < 0) {
             fprintf(stderr, "Error: failure in recording audio (%x)\n", err);
             exit(EXIT_FAILURE);
         }
-
-        // check if it bailed
-        if (audio->terminate == 1)
+        if (err == 0)
             break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PORTAUDIO_WAIT_TIMEOUT;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&ring.lock);
+        if (__atomic_load_n(&ring.write_pos, __ATOMIC_ACQUIRE) == ring.read_pos)
+            pthread_cond_timedwait(&ring.cond, &ring.lock, &deadline);
+        pthread_mutex_unlock(&ring.lock);
     }
+
     // close stream
     if ((err = Pa_CloseStream(stream)) != paNoError) {
         fprintf(stderr, "Error: failure in closing stream (%x)\n", err);
         exit(EXIT_FAILURE);
     }
 
-    portaudio_simple_free(data);
+    Pa_Terminate();
+    free(ring.frames);
+    pthread_cond_destroy(&ring.cond);
+    pthread_mutex_destroy(&ring.lock);
     return 0;
 }
@@ -1,143 +1,186 @@
 #include "input/pulse.h"
+#include "debug.h"
 #include "input/common.h"
 
 #include <pulse/error.h>
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
 
-pa_mainloop *m_pulseaudio_mainloop;
+// pulse: how often the capture thread looks at audio->terminate, in us. A suspended sink sends
+// nothing that could wake it
+#define PULSE_TERMINATE_CHECK 100000
+
+// pulseaudio mixes in float, so take it without converting
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_FLOAT32NE, .rate = 44100, .channels = 2};
+
+struct pulse_input {
+    struct audio_data *audio;
+    pa_threaded_mainloop *mainloop;
+    pa_context *context;
+    pa_stream *stream;
+    pa_buffer_attr attr;
+    bool follow_default; // source 'auto', record the monitor of whatever the default sink is
+    char *sink;          // default sink the stream records the monitor of
+};
+
+// pulse: report the error the way the other inputs do and wake the capture thread to stop
+static void fail(struct pulse_input *in, const char *fmt, const char *what) {
+    snprintf(in->audio->error_message, sizeof(in->audio->error_message), fmt, what,
+             pa_strerror(pa_context_errno(in->context)));
+    in->audio->terminate = 1;
+    pa_threaded_mainloop_signal(in->mainloop, 0);
+}
 
-void cb(__attribute__((unused)) pa_context *pulseaudio_context, const pa_server_info *i,
-        void *userdata) {
+// pulse: hand every fragment on straight out of the server's memory block, a hole in the stream is
+// only dropped
+static void stream_read(pa_stream *stream, __attribute__((unused)) size_t length, void *userdata) {
+    struct pulse_input *in = (struct pulse_input *)userdata;
+    const void *data;
+    size_t bytes;
+
+    while (pa_stream_readable_size(stream) > 0) {
+        if (pa_stream_peek(stream, &data, &bytes) < 0) {
+            fail(in, __FILE__ ": pa_stream_peek() failed on %s: %s\n", in->audio->source);
+            return;
+        }
+        if (bytes == 0)
+            break;
+        if (data)
+            write_input_frames(in->audio, data, bytes / pa_frame_size(&sample_spec), SAMPLE_FLOAT);
+        pa_stream_drop(stream);
+    }
+}
 
-    // getting default sink name
-    struct audio_data *audio = (struct audio_data *)userdata;
-    free(audio->source);
-    audio->source = malloc(sizeof(char) * 1024);
+static void stream_state(pa_stream *stream, void *userdata) {
+    struct pulse_input *in = (struct pulse_input *)userdata;
+    if (pa_stream_get_state(stream) == PA_STREAM_FAILED)
+        fail(in,
+             __FILE__ ": Could not open pulseaudio source: %s, %s. To find a list of your "
+                      "pulseaudio sources run 'pacmd list-sources'\n",
+             in->audio->source);
+}
 
-    strcpy(audio->source, i->default_sink_name);
+static void disconnect_stream(struct pulse_input *in) {
+    if (!in->stream)
+        return;
+    pa_stream_set_state_callback(in->stream, NULL, NULL);
+    pa_stream_set_read_callback(in->stream, NULL, NULL);
+    pa_stream_disconnect(in->stream);
+    pa_stream_unref(in->stream);
+    in->stream = NULL;
+}
 
-    // appending .monitor suufix
-    audio->source = strcat(audio->source, ".monitor");
+// the server sends fragments of about attr.fragsize, ADJUST_LATENCY keeps it from buffering more
+// than that at the source
+static void connect_stream(struct pulse_input *in, const char *source) {
+    in->stream = pa_stream_new(in->context, "audio for cava", &sample_spec, NULL);
+    pa_stream_set_state_callback(in->stream, stream_state, in);
+    pa_stream_set_read_callback(in->stream, stream_read, in);
+    if (pa_stream_connect_record(in->stream, source, &in->attr, PA_STREAM_ADJUST_LATENCY) < 0)
+        fail(in, __FILE__ ": Could not open pulseaudio source: %s, %s\n", source);
+}
 
-    // quiting mainloop
-    pa_context_disconnect(pulseaudio_context);
-    pa_context_unref(pulseaudio_context);
-    pa_mainloop_quit(m_pulseaudio_mainloop, 0);
-    pa_mainloop_free(m_pulseaudio_mainloop);
+// pulse [auto]: move the stream to the monitor of the default sink whenever that changes
+static void server_info(pa_context *context, const pa_server_info *info, void *userdata) {
+    struct pulse_input *in = (struct pulse_input *)userdata;
+    if (!info || !info->default_sink_name ||
+        (in->sink && strcmp(in->sink, info->default_sink_name) == 0))
+        return;
+
+    free(in->sink);
+    in->sink = strdup(info->default_sink_name);
+    free(in->audio->source);
+    in->audio->source = malloc(strlen(in->sink) + sizeof(".monitor"));
+    sprintf(in->audio->source, "%s.monitor", in->sink);
+    debug("recording %s\n", in->audio->source);
+
+    disconnect_stream(in);
+    if (pa_context_get_state(context) == PA_CONTEXT_READY)
+        connect_stream(in, in->audio->source);
 }
 
-void pulseaudio_context_state_callback(pa_context *pulseaudio_context, void *userdata) {
+static void context_event(pa_context *context, pa_subscription_event_type_t type,
+                          __attribute__((unused)) uint32_t index, void *userdata) {
+    if ((type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == PA_SUBSCRIPTION_EVENT_SERVER)
+        pa_operation_unref(pa_context_get_server_info(context, server_info, userdata));
+}
 
-    // make sure loop is ready
-    switch (pa_context_get_state(pulseaudio_context)) {
-    case PA_CONTEXT_UNCONNECTED:
-        // printf("UNCONNECTED\n");
-        break;
-    case PA_CONTEXT_CONNECTING:
-        // printf("CONNECTING\n");
-        break;
-    case PA_CONTEXT_AUTHORIZING:
-        // printf("AUTHORIZING\n");
-        break;
-    case PA_CONTEXT_SETTING_NAME:
-        // printf("SETTING_NAME\n");
-        break;
-    case PA_CONTEXT_READY: // extract default sink name
-        // printf("READY\n");
-        pa_operation_unref(pa_context_get_server_info(pulseaudio_context, cb, userdata));
+static void context_state(pa_context *context, void *userdata) {
+    struct pulse_input *in = (struct pulse_input *)userdata;
+
+    switch (pa_context_get_state(context)) {
+    case PA_CONTEXT_READY:
+        if (in->follow_default) {
+            pa_context_set_subscribe_callback(context, context_event, in);
+            pa_operation_unref(
+                pa_context_subscribe(context, PA_SUBSCRIPTION_MASK_SERVER, NULL, NULL));
+            pa_operation_unref(pa_context_get_server_info(context, server_info, in));
+        } else {
+            connect_stream(in, in->audio->source);
+        }
         break;
     case PA_CONTEXT_FAILED:
-        printf("failed to connect to pulseaudio server\n");
-        exit(EXIT_FAILURE);
-        break;
     case PA_CONTEXT_TERMINATED:
-        // printf("TERMINATED\n");
-        pa_mainloop_quit(m_pulseaudio_mainloop, 0);
+        fail(in, __FILE__ ": lost the pulseaudio server while recording %s: %s\n",
+             in->audio->source);
+        break;
+    default:
         break;
     }
 }
 
-void getPulseDefaultSink(void *data) {
-
-    struct audio_data *audio = (struct audio_data *)data;
-    pa_mainloop_api *mainloop_api;
-    pa_context *pulseaudio_context;
-    int ret;
-
-    // Create a mainloop API and connection to the default server
-    m_pulseaudio_mainloop = pa_mainloop_new();
-
-    mainloop_api = pa_mainloop_get_api(m_pulseaudio_mainloop);
-    pulseaudio_context = pa_context_new(mainloop_api, "cava device list");
-
-    // This function connects to the pulse server
-    pa_context_connect(pulseaudio_context, NULL, PA_CONTEXT_NOFLAGS, NULL);
-
-    //        printf("connecting to server\n");
-
-    // This function defines a callback so the server will tell us its state.
-    pa_context_set_state_callback(pulseaudio_context, pulseaudio_context_state_callback,
-                                  (void *)audio);
-
-    // starting a mainloop to get default sink
-
-    // starting with one nonblokng iteration in case pulseaudio is not able to run
-    if (!(ret = pa_mainloop_iterate(m_pulseaudio_mainloop, 0, &ret))) {
-        printf("Could not open pulseaudio mainloop to "
-               "find default device name: %d\n"
-               "check if pulseaudio is running\n",
-               ret);
-
-        exit(EXIT_FAILURE);
-    }
-
-    pa_mainloop_run(m_pulseaudio_mainloop, &ret);
+static void check_terminate(pa_mainloop_api *api, pa_time_event *event,
+                            __attribute__((unused)) const struct timeval *tv, void *userdata) {
+    struct pulse_input *in = (struct pulse_input *)userdata;
+    struct timeval next;
+    if (in->audio->terminate)
+        pa_threaded_mainloop_signal(in->mainloop, 0);
+    else
+        api->time_restart(event, pa_timeval_add(pa_gettimeofday(&next), PULSE_TERMINATE_CHECK));
 }
 
+// input: pulse. The stream is read on pulseaudio's own mainloop thread as fragments arrive, this
+// thread only sets it up and waits for the end
 void *input_pulse(void *data) {
-
     struct audio_data *audio = (struct audio_data *)data;
-    uint16_t frames = audio->FFTtreblebufferSize;
-    int channels = 2;
-    int16_t buf[frames * channels];
-
-    /* The sample type to use */
-    static const pa_sample_spec ss = {.format = PA_SAMPLE_S16LE, .rate = 44100, .channels = 2};
-
-    audio->format = 16;
-
-    const int frag_size = frames * channels * audio->format / 8 *
-                          2; // we double this because of cpu performance issues with pulseaudio
-
-    pa_buffer_attr pb = {.maxlength = (uint32_t)-1, // BUFSIZE * 2,
-                         .fragsize = frag_size};
-
-    pa_simple *s = NULL;
-    int error;
-
-    if (!(s = pa_simple_new(NULL, "cava", PA_STREAM_RECORD, audio->source, "audio for cava", &ss,
-                            NULL, &pb, &error))) {
-        sprintf(audio->error_message, __FILE__ ": Could not open pulseaudio source: %s, %s. \
-		To find a list of your pulseaudio sources run 'pacmd list-sources'\n",
-                audio->source, pa_strerror(error));
-
-        audio->terminate = 1;
-    }
-
-    while (!audio->terminate) {
-        if (pa_simple_read(s, buf, sizeof(buf), &error) < 0) {
-            sprintf(audio->error_message, __FILE__ ": pa_simple_read() failed: %s\n",
-                    pa_strerror(error));
-            audio->terminate = 1;
-        }
-
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(frames, buf, data);
-        pthread_mutex_unlock(&lock);
-    }
-
-    pa_simple_free(s);
-    pthread_exit(NULL);
+    struct pulse_input in = {.audio = audio, .follow_default = strcmp(audio->source, "auto") == 0};
+
+    audio->format = 32;
+
+    // fragments of the target latency, or of as many frames as cava reads at a time
+    uint32_t fragment = audio->latency > 0
+                            ? pa_usec_to_bytes(audio->latency * PA_USEC_PER_MSEC, &sample_spec)
+                            : audio->input_buffer_size * pa_frame_size(&sample_spec);
+    in.attr = (pa_buffer_attr){.maxlength = (uint32_t)-1,
+                               .tlength = (uint32_t)-1,
+                               .prebuf = (uint32_t)-1,
+                               .minreq = (uint32_t)-1,
+                               .fragsize = fragment};
+
+    in.mainloop = pa_threaded_mainloop_new();
+    pa_mainloop_api *api = pa_threaded_mainloop_get_api(in.mainloop);
+    in.context = pa_context_new(api, "cava");
+    pa_context_set_state_callback(in.context, context_state, &in);
+    if (pa_context_connect(in.context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+        fail(&in, __FILE__ ": failed to connect to pulseaudio server for %s: %s\n", audio->source);
+
+    struct timeval first;
+    pa_time_event *timer = api->time_new(
+        api, pa_timeval_add(pa_gettimeofday(&first), PULSE_TERMINATE_CHECK), check_terminate, &in);
+
+    pa_threaded_mainloop_start(in.mainloop);
+    pa_threaded_mainloop_lock(in.mainloop);
+    while (!audio->terminate)
+        pa_threaded_mainloop_wait(in.mainloop);
+
+    disconnect_stream(&in);
+    api->time_free(timer);
+    pa_context_set_state_callback(in.context, NULL, NULL);
+    pa_context_disconnect(in.context);
+    pa_context_unref(in.context);
+    pa_threaded_mainloop_unlock(in.mainloop);
+    pa_threaded_mainloop_stop(in.mainloop);
+    pa_threaded_mainloop_free(in.mainloop);
+    free(in.sink);
     return 0;
 }
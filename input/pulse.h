@@ -3,4 +3,3 @@
 #pragma once
 
 void *input_pulse(void *data);
-void getPulseDefaultSink();
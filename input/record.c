@@ -0,0 +1,234 @@
+#include "input/record.h"
+#include "debug.h"
+
+#include <time.h>
+
+// record: the writer thread puts what there is on disk at least this often, in ns
+#define RECORD_FLUSH_NS 100000000
+
+struct input_recorder {
+    char *path;
+    FILE *file;
+    uint8_t *ring;
+    // bytes the input has put into the ring and the writer has taken out of it, both only grow
+    size_t head, tail;
+    uint32_t lost;         // frames left out since the last RECORD_DROPPED
+    unsigned long dropped; // frames left out in all
+    // rate changes and resets that found the ring full, in the order they happened. They go in
+    // before the next event that fits, a rate with the last value it was set to
+    uint8_t pending[2];
+    int pending_count;
+    unsigned int pending_rate;
+    struct timespec start;
+    bool failed; // the writer could not write, the rest is discarded
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int waiting;
+    bool stop;
+};
+
+// record [writer]: says so once, the rest of the recording is discarded
+static void write_failed(struct input_recorder *r) {
+    fprintf(stderr, "could not write input recording %s: %s\n", r->path, strerror(errno));
+    r->failed = true;
+}
+
+// record [writer]: empties the ring into the file. The input only wakes it when the ring fills up,
+// otherwise it looks every RECORD_FLUSH_NS
+static void *write_log(void *data) {
+    struct input_recorder *r = (struct input_recorder *)data;
+
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        bool stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+
+        size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), tail = r->tail;
+        while (tail != head) {
+            size_t at = tail & (RECORD_RING_BYTES - 1);
+            size_t n = head - tail < RECORD_RING_BYTES - at ? head - tail : RECORD_RING_BYTES - at;
+            if (!r->failed && fwrite(r->ring + at, 1, n, r->file) != n)
+                write_failed(r);
+            tail += n;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        if (!r->failed && fflush(r->file) != 0)
+            write_failed(r);
+
+        pthread_mutex_lock(&r->lock);
+        if (stop)
+            break;
+        if (!r->stop) {
+            struct timespec deadline;
+#ifndef NORT
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+            clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+            deadline.tv_nsec += RECORD_FLUSH_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+            pthread_cond_timedwait(&r->cond, &r->lock, &deadline);
+            __atomic_store_n(&r->waiting, 0, __ATOMIC_SEQ_CST);
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+struct input_recorder *start_recording(const char *path) {
+    struct input_recorder *r = (struct input_recorder *)calloc(1, sizeof(struct input_recorder));
+    r->path = strdup(path);
+    r->file = fopen(path, "wb");
+    if (r->file == NULL) {
+        fprintf(stderr, "could not open input recording %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_BYTES, r->file);
+    r->ring = (uint8_t *)malloc(RECORD_RING_BYTES);
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef NORT
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&r->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_create(&r->thread, NULL, write_log, r);
+    debug("recording input to %s\n", path);
+    return r;
+}
+
+const char *recording_path(const struct input_recorder *recorder) { return recorder->path; }
+
+// record: appends one event to the ring, false if there is no room for all of it. Only the input
+// moves head, so nothing but the tail has to be read atomically
+static bool push(struct input_recorder *r, enum record_event event, uint32_t frames, int format,
+                 const void *data, size_t bytes) {
+    size_t head = r->head;
+    size_t used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (RECORD_RING_BYTES - used < sizeof(struct record_header) + bytes)
+        return false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct record_header h = {
+        .time = (uint64_t)(now.tv_sec - r->start.tv_sec) * 1000000000 + now.tv_nsec -
+                r->start.tv_nsec,
+        .frames = frames,
+        .event = event,
+        .format = format,
+    };
+
+    const uint8_t *pieces[2] = {(const uint8_t *)&h, (const uint8_t *)data};
+    size_t sizes[2] = {sizeof(h), bytes};
+    for (int p = 0; p < (bytes > 0 ? 2 : 1); p++) {
+        size_t at = head & (RECORD_RING_BYTES - 1);
+        size_t n = sizes[p] < RECORD_RING_BYTES - at ? sizes[p] : RECORD_RING_BYTES - at;
+        memcpy(r->ring + at, pieces[p], n);
+        memcpy(r->ring, pieces[p] + n, sizes[p] - n);
+        head += sizes[p];
+    }
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    used += sizeof(h) + bytes;
+
+    // the writer looks on its own soon enough while the ring is less than half full
+    if (used > RECORD_RING_BYTES / 2 && __atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST) &&
+        pthread_mutex_trylock(&r->lock) == 0) {
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return true;
+}
+
+// record: catches up on what the ring had no room for, first how many frames were left out so the
+// replay fills in silence, then the rate changes and resets. False if some of it still does not fit
+static bool push_pending(struct input_recorder *r) {
+    if (r->lost > 0) {
+        if (!push(r, RECORD_DROPPED, r->lost, 0, NULL, 0))
+            return false;
+        r->lost = 0;
+    }
+    while (r->pending_count > 0) {
+        enum record_event event = r->pending[0];
+        if (!push(r, event, event == RECORD_RATE ? r->pending_rate : 0, 0, NULL, 0))
+            return false;
+        r->pending[0] = r->pending[1];
+        r->pending_count--;
+    }
+    return true;
+}
+
+// record: an event goes in only together with everything pending before it, so a full ring adds
+// to one RECORD_DROPPED instead of writing one for every block left out
+static bool push_event(struct input_recorder *r, enum record_event event, uint32_t frames,
+                       int format, const void *data, size_t bytes) {
+    size_t used = r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t catch_up = ((r->lost > 0) + r->pending_count) * sizeof(struct record_header);
+    if (RECORD_RING_BYTES - used < catch_up + sizeof(struct record_header) + bytes)
+        return false;
+    return push_pending(r) && push(r, event, frames, format, data, bytes);
+}
+
+// record: a rate change or reset that did not fit is kept for push_pending, once per kind
+static void keep_pending(struct input_recorder *r, enum record_event event) {
+    for (int p = 0; p < r->pending_count; p++)
+        if (r->pending[p] == event)
+            return;
+    r->pending[r->pending_count++] = event;
+}
+
+void record_block(struct input_recorder *recorder, const void *buf, int frames,
+                  enum sample_format format) {
+    size_t bytes = (size_t)frames * 2 * sample_format_bytes(format);
+    if (!push_event(recorder, RECORD_BLOCK, frames, format, buf, bytes)) {
+        recorder->lost += frames;
+        recorder->dropped += frames;
+    }
+}
+
+void record_rate(struct input_recorder *recorder, unsigned int rate) {
+    if (!push_event(recorder, RECORD_RATE, rate, 0, NULL, 0)) {
+        recorder->pending_rate = rate;
+        keep_pending(recorder, RECORD_RATE);
+    }
+}
+
+void record_reset(struct input_recorder *recorder) {
+    if (!push_event(recorder, RECORD_RESET, 0, 0, NULL, 0))
+        keep_pending(recorder, RECORD_RESET);
+}
+
+void stop_recording(struct input_recorder *recorder) {
+    // the input is done, so what is still pending can wait for the writer to make room
+    struct timespec req = {.tv_sec = 0, .tv_nsec = 1000000};
+    while (!push_pending(recorder)) {
+        pthread_mutex_lock(&recorder->lock);
+        pthread_cond_signal(&recorder->cond);
+        pthread_mutex_unlock(&recorder->lock);
+        nanosleep(&req, NULL);
+    }
+
+    pthread_mutex_lock(&recorder->lock);
+    recorder->stop = true;
+    pthread_cond_signal(&recorder->cond);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->thread, NULL);
+
+    if (recorder->dropped > 0)
+        fprintf(stderr, "input recording %s is missing %lu frames, it could not be written fast "
+                        "enough\n",
+                recorder->path, recorder->dropped);
+    fclose(recorder->file);
+    pthread_cond_destroy(&recorder->cond);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder->ring);
+    free(recorder->path);
+    free(recorder);
+}
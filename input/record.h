@@ -0,0 +1,48 @@
+// header file for record, part of cava.
+
+#pragma once
+
+#include "input/common.h"
+
+// input [record]: a log starts with RECORD_MAGIC followed by one record_header per event. A block
+// is followed by its frames as the backend delivered them, everything is in native byte order
+#define RECORD_MAGIC "cavarec1"
+#define RECORD_MAGIC_BYTES 8
+
+// input [record]: bytes of log the input may be ahead of the disk, about ten seconds of 48kHz float
+// stereo. A power of two, and no event with its frames is larger
+#define RECORD_RING_BYTES (4 << 20)
+
+enum record_event {
+    RECORD_BLOCK,   // frames handed to write_input_frames()
+    RECORD_RATE,    // set_input_rate() or a start of the input, frames is the rate
+    RECORD_RESET,   // reset_output_buffers()
+    RECORD_DROPPED, // frames the writer had no room for, they are missing from the log
+};
+
+struct record_header {
+    uint64_t time;   // ns since the recording started
+    uint32_t frames; // frames of a block, the rate of RECORD_RATE
+    uint8_t event;   // enum record_event
+    uint8_t format;  // enum sample_format of a block
+    uint16_t reserved;
+};
+
+struct input_recorder;
+
+// opens the log, exits if it can't be written
+struct input_recorder *start_recording(const char *path);
+
+const char *recording_path(const struct input_recorder *recorder);
+
+// called by the one thread that writes the input, they only copy into a buffer and never block it.
+// What does not fit is left out and marked in the log
+void record_block(struct input_recorder *recorder, const void *buf, int frames,
+                  enum sample_format format);
+
+void record_rate(struct input_recorder *recorder, unsigned int rate);
+
+void record_reset(struct input_recorder *recorder);
+
+// writes what is left, the input must not record anything anymore
+void stop_recording(struct input_recorder *recorder);
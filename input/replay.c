@@ -0,0 +1,137 @@
+#include "input/replay.h"
+#include "debug.h"
+#include "input/common.h"
+#include "input/record.h"
+
+#include <time.h>
+
+// replay: frames the recorder left out are filled in with this many frames of silence at a time
+#define SILENCE_FRAMES 1024
+
+// replay [paced]: waits until the event recorded at time ns is due at speed times the original pace
+static void wait_until(struct timespec *origin, uint64_t *origin_time, uint64_t time,
+                       double speed) {
+    long ns = (time - *origin_time) / speed;
+    struct timespec due = *origin;
+    due.tv_sec += ns / 1000000000;
+    due.tv_nsec += ns % 1000000000;
+    if (due.tv_nsec >= 1000000000) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000;
+    }
+    // do not catch up on more than a second when we were held up, by a change of rate for one
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > due.tv_sec + 1) {
+        *origin = now;
+        *origin_time = time;
+        return;
+    }
+#ifndef NORT
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+#else
+    long wait_ns = (due.tv_sec - now.tv_sec) * 1000000000L + due.tv_nsec - now.tv_nsec;
+    if (wait_ns > 0) {
+        struct timespec req = {.tv_sec = wait_ns / 1000000000, .tv_nsec = wait_ns % 1000000000};
+        nanosleep(&req, NULL);
+    }
+#endif
+}
+
+// input: replay. Feeds a log written by the recorder back in its original blocks, at speed times
+// the pace they arrived at. With speed 0 it renders offline instead, every frame gets the blocks
+// that had arrived by its time in the recording. cava quits at the end of the log
+void *input_replay(void *data) {
+    struct audio_data *audio = (struct audio_data *)data;
+
+    FILE *log = fopen(audio->source, "rb");
+    if (log == NULL) {
+        fprintf(stderr, __FILE__ ": could not open %s: %s\n", audio->source, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char magic[RECORD_MAGIC_BYTES];
+    if (fread(magic, 1, RECORD_MAGIC_BYTES, log) != RECORD_MAGIC_BYTES ||
+        memcmp(magic, RECORD_MAGIC, RECORD_MAGIC_BYTES) != 0) {
+        fprintf(stderr, __FILE__ ": %s is no input recording of cava\n", audio->source);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 0;
+    uint8_t *buf = NULL;
+    int16_t silence[2 * SILENCE_FRAMES] = {0};
+    audio->format = 16;
+
+    struct timespec origin;
+    uint64_t origin_time = 0;
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+    uint64_t frame = 1; // offline: the frame the blocks go to, it ends at frame / framerate s
+    uint64_t framerate = audio->framerate > 0 ? audio->framerate : 1;
+    bool pending = false; // offline: there is audio for the frame
+
+    struct record_header h;
+    while (!audio->terminate && fread(&h, sizeof(h), 1, log) == 1) {
+        if (h.event == RECORD_BLOCK) {
+            if (h.format > SAMPLE_FLOAT_SWAPPED)
+                break;
+            // the recorder never wrote a block larger than its ring, a log that says so is broken
+            size_t bytes = (size_t)h.frames * 2 * sample_format_bytes(h.format);
+            if (bytes > RECORD_RING_BYTES - sizeof(h)) {
+                fprintf(stderr, __FILE__ ": %s has a block of %u frames, it is broken\n",
+                        audio->source, h.frames);
+                break;
+            }
+            if (bytes > capacity) {
+                uint8_t *grown = (uint8_t *)realloc(buf, bytes);
+                if (grown == NULL) {
+                    fprintf(stderr, __FILE__ ": no memory for a block of %u frames\n", h.frames);
+                    break;
+                }
+                buf = grown;
+                capacity = bytes;
+            }
+            // a recording that was cut short ends in the middle of a block
+            if (fread(buf, 1, bytes, log) != bytes)
+                break;
+        }
+
+        if (!audio->offline) {
+            wait_until(&origin, &origin_time, h.time, audio->speed);
+        } else {
+            while (h.time >= frame * 1000000000 / framerate && !audio->terminate) {
+                offline_frame_ready(audio);
+                frame++;
+                pending = false;
+            }
+            if (h.event != RECORD_RATE)
+                pending = true;
+        }
+
+        switch (h.event) {
+        case RECORD_BLOCK:
+            audio->format = 8 * sample_format_bytes(h.format);
+            write_input_frames(audio, buf, h.frames, h.format);
+            break;
+        case RECORD_RATE:
+            set_input_rate(audio, h.frames);
+            break;
+        case RECORD_RESET:
+            reset_output_buffers(audio);
+            break;
+        case RECORD_DROPPED:
+            for (uint32_t n = 0; n < h.frames; n += SILENCE_FRAMES)
+                write_input_frames(audio, silence,
+                                   h.frames - n < SILENCE_FRAMES ? h.frames - n : SILENCE_FRAMES,
+                                   SAMPLE_S16);
+            break;
+        default:
+            debug("replay: skipping event %d\n", h.event);
+        }
+    }
+    if (audio->offline && pending && !audio->terminate)
+        offline_frame_ready(audio);
+    offline_input_end(audio);
+
+    free(buf);
+    fclose(log);
+    return 0;
+}
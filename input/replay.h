@@ -0,0 +1,5 @@
+// header file for replay, part of cava.
+
+#pragma once
+
+void *input_replay(void *data);
@@ -25,18 +25,17 @@ typedef struct {
     s16_t buffer[VIS_BUF_SIZE];
 } vis_t;
 
+// how often to look for new frames: at least this often in ns, at most every quarter of the buffer
+// so squeezelite cannot lap us, and while nothing is playing every SHMEM_IDLE_INTERVAL
+#define SHMEM_MIN_INTERVAL 5000000
+#define SHMEM_IDLE_INTERVAL 100000000
+
 // input: SHMEM
 void *input_shmem(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
     vis_t *mmap_area;
     int fd; /* file descriptor to mmaped area */
     int mmap_count = sizeof(vis_t);
-    int buf_frames;
-    struct timespec req = {.tv_sec = 0, .tv_nsec = 0};
-
-    s16_t silence_buffer[VIS_BUF_SIZE];
-    for (int i = 0; i < VIS_BUF_SIZE; i++)
-        silence_buffer[i] = 0;
 
     printf("input_shmem: source: %s", audio->source);
 
@@ -53,26 +52,51 @@ void *input_shmem(void *data) {
         }
     }
 
+    // squeezelite writes interleaved frames to buffer[buf_index], looping around the whole array,
+    // and moves buf_index past them. Everything before read_index has been passed on already
+    u32_t read_index = mmap_area->buf_index;
+    long interval = SHMEM_MIN_INTERVAL;
+    s16_t frames[VIS_BUF_SIZE];
+
     while (!audio->terminate) {
-        // audio rate may change between songs (e.g. 44.1kHz to 96kHz)
-        audio->rate = mmap_area->rate;
-        buf_frames = mmap_area->buf_size / 2;
-        // reread after the whole buffer has changed
-        req.tv_nsec = (1000000 / mmap_area->rate) * buf_frames;
-        if (mmap_area->running) {
-            // Frames are written by squeezelite to the buffer array starting from
-            // buffer[buf_index + 1], looping around the whole array.
-            // Thus, the starting position only affects the phase spectrum of the
-            // fft, and not the power spectrum, so we can just read in the
-            // whole buffer.
-            pthread_mutex_lock(&lock);
-            write_to_fftw_input_buffers(buf_frames, mmap_area->buffer, audio);
-            pthread_mutex_unlock(&lock);
-            nanosleep(&req, NULL);
+        // the read lock keeps squeezelite from writing while we copy the new frames out, they are
+        // only converted once it can write again
+        pthread_rwlock_rdlock(&mmap_area->rwlock);
+        u32_t rate = mmap_area->rate, size = mmap_area->buf_size, index = mmap_area->buf_index;
+        bool running = mmap_area->running && rate > 0;
+        if (size == 0 || size > VIS_BUF_SIZE)
+            size = VIS_BUF_SIZE;
+        u32_t samples = 0;
+        if (running && rate == audio->input_rate && read_index < size && index < size) {
+            samples = (index + size - read_index) % size;
+            u32_t first = size - read_index < samples ? size - read_index : samples;
+            memcpy(frames, mmap_area->buffer + read_index, first * sizeof(s16_t));
+            memcpy(frames + first, mmap_area->buffer, (samples - first) * sizeof(s16_t));
+        }
+        read_index = index;
+        pthread_rwlock_unlock(&mmap_area->rwlock);
+        write_input_frames(audio, frames, samples / 2, SAMPLE_S16);
+
+        if (!running) {
+            reset_output_buffers(audio);
+            interval = SHMEM_IDLE_INTERVAL;
+        } else if (rate != audio->input_rate) {
+            // audio rate may change between songs (e.g. 44.1kHz to 96kHz), the FFT sizes are
+            // rebuilt for it before we read again
+            set_input_rate(audio, rate);
+            continue;
         } else {
-            write_to_fftw_input_buffers(buf_frames, silence_buffer, audio);
-            nanosleep(&req, NULL);
+            // settle on how often squeezelite updates: back off while we find nothing new, move
+            // closer while every look finds frames
+            long longest = 1000000000LL * size / 8 / rate;
+            interval = samples == 0 ? interval * 2 : interval * 3 / 4;
+            if (interval > longest)
+                interval = longest;
+            if (interval < SHMEM_MIN_INTERVAL)
+                interval = SHMEM_MIN_INTERVAL;
         }
+        struct timespec req = {.tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000};
+        nanosleep(&req, NULL);
     }
 
     // cleanup
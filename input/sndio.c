@@ -1,52 +1,105 @@
 #include "input/sndio.h"
+#include "debug.h"
 #include "input/common.h"
 
 #include <sndio.h>
 
+// sndio: the sample format of what the device gave us, sndio describes it by bits, bytes per
+// sample, byte order and alignment
+static bool sndio_format(const struct sio_par *par, enum sample_format *format) {
+    bool native = par->le == SIO_LE_NATIVE;
+    if (!par->sig)
+        return false;
+    if (par->bps == 2 && par->bits == 16)
+        *format = native ? SAMPLE_S16 : SAMPLE_S16_SWAPPED;
+    else if (par->bps == 3 && par->bits == 24)
+        *format = par->le ? SAMPLE_S24_3LE : SAMPLE_S24_3BE;
+    // 24 bits aligned to the top of 4 bytes are 32 bit samples with the low byte zero
+    else if (par->bps == 4 && (par->bits == 32 || par->msb))
+        *format = native ? SAMPLE_S32 : SAMPLE_S32_SWAPPED;
+    else if (par->bps == 4 && par->bits == 24 && native)
+        *format = SAMPLE_S24;
+    else
+        return false;
+    return true;
+}
+
+// ask for 24 bit stereo and take the rate and format the device has, sndiod then does not
+// resample or dither for us and nothing is lost before the FFT. Rate and round stay up to the
+// device when 0
+static void set_params(struct sio_hdl *hdl, struct sio_par *par, unsigned int rate,
+                       unsigned int round) {
+    sio_initpar(par);
+    par->sig = 1;
+    par->bits = 24;
+    par->le = SIO_LE_NATIVE;
+    par->rchan = 2;
+    if (rate > 0)
+        par->rate = rate;
+    if (round > 0) {
+        par->round = round;
+        par->appbufsz = 2 * round;
+    }
+    if (!sio_setpar(hdl, par) || !sio_getpar(hdl, par)) {
+        fprintf(stderr, __FILE__ ": Could not set audio parameters\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
 void *input_sndio(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
     struct sio_par par;
     struct sio_hdl *hdl;
-    int16_t buf[audio->FFTtreblebufferSize * 2];
-
-    sio_initpar(&par);
-    par.sig = 1;
-    par.bits = 16;
-    par.le = 1;
-    par.rate = 44100;
-    par.rchan = 2;
-    par.appbufsz = sizeof(buf) / par.rchan;
+    enum sample_format format;
 
     if ((hdl = sio_open(audio->source, SIO_REC, 0)) == NULL) {
         fprintf(stderr, __FILE__ ": Could not open sndio source: %s\n", audio->source);
         exit(EXIT_FAILURE);
     }
 
-    if (!sio_setpar(hdl, &par) || !sio_getpar(hdl, &par) || par.sig != 1 || par.le != 1 ||
-        par.rate != 44100 || par.rchan != audio->channels) {
-        fprintf(stderr, __FILE__ ": Could not set required audio parameters\n");
+    set_params(hdl, &par, 0, 0);
+    // blocks of the latency target at the rate we got, without one the device's own block size
+    if (audio->latency > 0) {
+        unsigned int round = par.rate * audio->latency / 1000;
+        set_params(hdl, &par, par.rate, round > 0 ? round : 1);
+    }
+
+    if (par.rchan != 2 || !sndio_format(&par, &format)) {
+        fprintf(stderr,
+                __FILE__ ": unsupported audio parameters: %u channels of %u bit %s samples in %u "
+                         "bytes\n",
+                par.rchan, par.bits, par.sig ? "signed" : "unsigned", par.bps);
         exit(EXIT_FAILURE);
     }
+    debug("sndio: %u Hz, %u bits in %u bytes, blocks of %u frames\n", par.rate, par.bits, par.bps,
+          par.round);
+
+    audio->format = par.bits;
+    set_input_rate(audio, par.rate);
+
+    size_t frame_bytes = par.rchan * par.bps;
+    size_t bytes = par.round * frame_bytes;
+    void *buf = malloc(bytes);
 
     if (!sio_start(hdl)) {
         fprintf(stderr, __FILE__ ": sio_start() failed\n");
         exit(EXIT_FAILURE);
     }
 
-    uint16_t frames = (sizeof(buf) / sizeof(buf[0])) / 2;
     while (audio->terminate != 1) {
-        if (sio_read(hdl, buf, sizeof(buf)) == 0) {
+        // blocks until the whole block is there
+        size_t n = sio_read(hdl, buf, bytes);
+        if (n == 0) {
             fprintf(stderr, __FILE__ ": sio_read() failed: %s\n", strerror(errno));
             exit(EXIT_FAILURE);
         }
 
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(frames, buf, audio);
-        pthread_mutex_unlock(&lock);
+        write_input_frames(audio, buf, n / frame_bytes, format);
     }
 
     sio_stop(hdl);
     sio_close(hdl);
+    free(buf);
 
     return 0;
 }
@@ -0,0 +1,185 @@
+#include "input/synthetic.h"
+#include "input/common.h"
+
+#include <math.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932385
+#endif
+
+// synthetic: test signals computed on the fly, the same on every run. A sweep goes up from
+// SWEEP_LOW to just below half the rate in SWEEP_SECONDS and starts over, a chord defaults to A
+// minor, noise comes from a fixed seed and impulses are one full scale frame per second
+#define SWEEP_LOW 20.0
+#define SWEEP_SECONDS 10
+#define MAX_TONES 8
+
+enum signal {
+    SIGNAL_SWEEP,
+    SIGNAL_CHORD,
+    SIGNAL_WHITE,
+    SIGNAL_PINK,
+    SIGNAL_IMPULSE,
+    SIGNAL_SILENCE
+};
+
+static const char *signal_names[] = {"sweep", "chord", "white", "pink", "impulse", "silence"};
+
+struct generator {
+    enum signal signal;
+    double rate;
+    long frame; // frames generated so far
+    int tone_count;
+    double tone[MAX_TONES], phase[MAX_TONES];
+    uint32_t noise;  // xorshift state
+    double pink[7]; // pinking filter state
+};
+
+// synthetic: source is the name of a signal, a chord can list its tones in Hz after a colon, as in
+// chord:220,277.2,329.6
+static bool parse_signal(struct generator *g, const char *source) {
+    size_t name = strcspn(source, ":");
+    g->signal = 0;
+    while (g->signal <= SIGNAL_SILENCE && (strlen(signal_names[g->signal]) != name ||
+                                           strncmp(source, signal_names[g->signal], name) != 0))
+        g->signal++;
+    if (g->signal > SIGNAL_SILENCE || (source[name] == ':' && g->signal != SIGNAL_CHORD))
+        return false;
+
+    if (g->signal == SIGNAL_CHORD && source[name] == ':') {
+        const char *s = source + name;
+        for (g->tone_count = 0; *s == ':' || *s == ','; g->tone_count++) {
+            char *end;
+            if (g->tone_count == MAX_TONES)
+                return false;
+            g->tone[g->tone_count] = strtod(s + 1, &end);
+            if (end == s + 1 || g->tone[g->tone_count] <= 0)
+                return false;
+            s = end;
+        }
+        return *s == '\0';
+    }
+    if (g->signal != SIGNAL_CHORD)
+        return true;
+    g->tone_count = 3;
+    g->tone[0] = 220.0;
+    g->tone[1] = 261.63;
+    g->tone[2] = 329.63;
+    return true;
+}
+
+// xorshift32, uniform from -1 to 1
+static double next_noise(struct generator *g) {
+    g->noise ^= g->noise << 13;
+    g->noise ^= g->noise >> 17;
+    g->noise ^= g->noise << 5;
+    return g->noise / 2147483648.0 - 1.0;
+}
+
+static float next_sample(struct generator *g) {
+    double sample = 0;
+    switch (g->signal) {
+    case SIGNAL_SWEEP: {
+        double t = (double)(g->frame % (long)(SWEEP_SECONDS * g->rate)) / g->rate;
+        double high = 0.45 * g->rate;
+        sample = 0.5 * sin(g->phase[0]);
+        g->phase[0] += 2 * M_PI * SWEEP_LOW * pow(high / SWEEP_LOW, t / SWEEP_SECONDS) / g->rate;
+        g->phase[0] = fmod(g->phase[0], 2 * M_PI);
+        break;
+    }
+    case SIGNAL_CHORD:
+        for (int n = 0; n < g->tone_count; n++) {
+            sample += 0.5 / g->tone_count * sin(g->phase[n]);
+            g->phase[n] = fmod(g->phase[n] + 2 * M_PI * g->tone[n] / g->rate, 2 * M_PI);
+        }
+        break;
+    case SIGNAL_WHITE:
+        sample = 0.5 * next_noise(g);
+        break;
+    case SIGNAL_PINK: {
+        // Paul Kellet's refined pinking filter, -3dB per octave within 0.05dB above 9Hz at 44.1kHz
+        double white = next_noise(g), *b = g->pink;
+        b[0] = 0.99886 * b[0] + white * 0.0555179;
+        b[1] = 0.99332 * b[1] + white * 0.0750759;
+        b[2] = 0.96900 * b[2] + white * 0.1538520;
+        b[3] = 0.86650 * b[3] + white * 0.3104856;
+        b[4] = 0.55000 * b[4] + white * 0.5329522;
+        b[5] = -0.7616 * b[5] - white * 0.0168980;
+        sample = 0.1 * (b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + white * 0.5362);
+        b[6] = white * 0.115926;
+        break;
+    }
+    case SIGNAL_IMPULSE:
+        sample = g->frame % (long)g->rate == 0 ? 1.0 : 0.0;
+        break;
+    case SIGNAL_SILENCE:
+        break;
+    }
+    g->frame++;
+    return sample;
+}
+
+// input: synthetic. Generates block_size frames at a time at the rate the FFTs were sized for,
+// paced to speed times realtime. With speed 0 it renders offline instead, every frame gets the
+// blocks that end by its time in the signal and the next ones are generated while it is drawn
+void *input_synthetic(void *data) {
+    struct audio_data *audio = (struct audio_data *)data;
+    struct generator g = {.rate = audio->input_rate, .noise = 0x9e3779b9};
+
+    if (!parse_signal(&g, audio->source)) {
+        fprintf(stderr,
+                __FILE__ ": unknown signal '%s', supported are: 'sweep', 'chord', "
+                         "'chord:<Hz>,<Hz>,...', 'white', 'pink', 'impulse' and 'silence'\n",
+                audio->source);
+        exit(EXIT_FAILURE);
+    }
+
+    audio->format = 32;
+    int block = audio->block_size;
+    float *buf = (float *)malloc(2 * block * sizeof(float));
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    unsigned long long generated = 0, frame = 1; // offline: frame k ends at k / framerate s
+    unsigned long long framerate = audio->framerate > 0 ? audio->framerate : 1;
+    while (audio->terminate != 1) {
+        for (int n = 0; n < block; n++)
+            buf[2 * n] = buf[2 * n + 1] = next_sample(&g);
+        write_input_frames(audio, buf, block, SAMPLE_FLOAT);
+
+        if (audio->offline) {
+            generated += block;
+            while (frame * g.rate <= generated * framerate && audio->terminate != 1) {
+                offline_frame_ready(audio);
+                frame++;
+            }
+        } else {
+            long ns = 1e9 * block / (g.rate * audio->speed);
+            next.tv_sec += ns / 1000000000;
+            next.tv_nsec += ns % 1000000000;
+            if (next.tv_nsec >= 1000000000) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000;
+            }
+            // do not catch up on more than a second when we were held up
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > next.tv_sec + 1)
+                next = now;
+#ifndef NORT
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+#else
+            long wait_ns = (next.tv_sec - now.tv_sec) * 1000000000L + next.tv_nsec - now.tv_nsec;
+            if (wait_ns > 0) {
+                struct timespec req = {.tv_sec = wait_ns / 1000000000,
+                                       .tv_nsec = wait_ns % 1000000000};
+                nanosleep(&req, NULL);
+            }
+#endif
+        }
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,5 @@
+// header file for synthetic, part of cava.
+
+#pragma once
+
+void *input_synthetic(void *data);